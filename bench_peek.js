@@ -0,0 +1,44 @@
+/*
+ * Microbenchmark for the heap accessors: a synthetic loop of ri32/wi32 on
+ * small word values plus byte loads, through o+heap_ closures like the ones
+ * cjsawk_smold.js used to install.  The mix is modelled on m0 but it is not
+ * m0; it compares the accessors with each other and says nothing about how
+ * much of a real stage's time they account for.  For that, time the stage
+ * itself, e.g. with js_min --gc-stats - cjsawk_smold.js --cmd m0 ...
+ *
+ * Run with js.exe so gc() reports the GC heap: "before" is what the loop
+ * left behind since the previous collection.
+ *
+ *   artifacts/js.exe bench_peek.js [iterations]
+ */
+
+dlsym = ffi_bind(get_dlsym(), "p(ps)");
+calloc = ffi_bind(dlsym(0, "calloc"), "p(ii)");
+
+var n = arguments[0] ? parseInt(arguments[0]) : 1000000;
+var heap_size = 1024*1024;
+var heap_ = calloc(heap_size, 1);
+
+function run(name, ri8, ri32, wi32) {
+  var t = new Date();
+  var i, o, v = 0;
+  gc();
+  for (i = 0; i < n; i++) {
+    o = (i * 4) & (heap_size - 4);
+    wi32(o, i & 0xffff);
+    v += ri32(o);
+    v += ri8(o + 1);
+  }
+  print(name + ": " + (new Date() - t) + " ms, checksum " + v);
+  gc();
+}
+
+run("peek8/peek32/poke32 ",
+    function(o) { return peek8(o+heap_); },
+    function(o) { return peek32(o+heap_); },
+    function(o, v) { poke32(o+heap_, v); });
+
+run("peek8u/peek32s/poke32s",
+    function(o) { return peek8u(o+heap_); },
+    function(o) { return peek32s(o+heap_); },
+    function(o, v) { poke32s(o+heap_, v); });
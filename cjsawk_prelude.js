@@ -0,0 +1,157 @@
+/*
+ * Setup shared by every cjsawk_smold.js command: the ffi bindings, the
+ * heap and the stage loader.  It reads no arguments, so a zygote can run
+ * it once with --prelude and fork each command off the result; otherwise
+ * cjsawk_smold.js loads it first.
+ */
+
+Uint8Array = Array;
+
+read_=read;
+
+/* in-memory files passed between pipeline stages, name -> ByteBuffer */
+vfs = {};
+
+/* file x as a ByteBuffer, from vfs if a stage left it there */
+read_bytes=function(x){
+  return vfs.hasOwnProperty(x) ? vfs[x] : readBytes(x);
+};
+
+read=function(x,y){
+  var b;
+  if(arguments.length>1){
+    if(y==="binary"){
+      /* stage scripts expect a plain Array of byte values */
+      b = read_bytes(x);
+      return copyHeapToArray(b.pointer(), b.length);
+    }
+  }
+  if(vfs.hasOwnProperty(x)) {
+    b = vfs[x];
+    return copyHeapToString(b.pointer(), b.length);
+  }
+  return read_(x);
+};
+
+function gen_out2(){
+  if(out_file[out_file.length-1]=== mkc("\n")){
+   out_file.pop();
+  }
+  for(var i = 0; i < out_file.length;i++) {
+    out_file[i] = String.fromCharCode(out_file[i]);
+  }
+  return out_file.join("");
+}
+
+load_ = load;
+
+dlsym = ffi_bind(get_dlsym(), "p(ps)");
+
+libc = {};
+
+libc.calloc = ffi_bind(dlsym(0, "calloc"), "p(ii)");
+libc.fopen = ffi_bind(dlsym(0, "fopen"), "p(ss)");
+libc.fwrite = ffi_bind(dlsym(0, "fwrite"), "i(piip)");
+libc.fclose = ffi_bind(dlsym(0, "fclose"), "i(p)");
+libc.exit = ffi_bind(dlsym(0, "exit"), "v(i)");
+
+(function() {
+  /* 16 MB up front, growing on demand into a 256 MB reservation */
+  var heap = heap_region(16*1024*1024, 256*1024*1024);
+
+  wi8_ = heap.wi8;
+  ri8_ = heap.ri8;
+  wi32_ = heap.wi32;
+  ri32_ = heap.ri32;
+
+  /* hand the next stage a zeroed heap, as a fresh shell would */
+  reset_heap = function() {
+    heap.shrink(0);
+    heap.grow(16*1024*1024);
+  };
+})();
+
+load = function(name) {
+//  print("load: " + name);
+  load_(name);
+  if((name === "cjsawk.js") || (name === "m0.js")) {
+    wi8 = wi8_;
+    ri8 = ri8_;
+    wi32 = wi32_;
+    ri32 = ri32_;
+    gen_out = function(){return "dummy gen_out";};
+  }
+  return;
+}
+
+function write_file(oname, data) {
+  if(oname === undefined) {
+    throw "oname is undefined";
+  }
+  writeFile(oname, data);
+}
+
+/* dummy buffer implementation */
+function Buffer() {
+  return "dummy buffer impl";
+}
+
+stages = {cjsawk: "cjsawk_test.js", m0: "m0_test.js", hex2: "hex2_test.js"};
+
+/* a zygote has the stage scripts read before its first job */
+if(typeof preload === "function" && arguments.length === 0) {
+  preload(stages.cjsawk, stages.m0, stages.hex2);
+}
+
+function run_stage(cmd, infile) {
+  reset_heap();
+  fname = infile;
+  load(stages[cmd]);
+  return out_file;
+}
+
+prefix_cache = {};
+
+function prefix_bytes(name) {
+  if(!prefix_cache.hasOwnProperty(name)) {
+    prefix_cache[name] = readBytes(name);
+  }
+  return prefix_cache[name];
+}
+
+function concat_bytes(parts) {
+  var i, b, n = 0, off = 0;
+  for(i = 0; i < parts.length; i++) {
+    if(!(parts[i] instanceof ByteBuffer)) {
+      parts[i] = new ByteBuffer(parts[i]);
+    }
+    n += parts[i].length;
+  }
+  b = new ByteBuffer(n);
+  for(i = 0; i < parts.length; i++) {
+    memcpy(b.pointer() + off, parts[i].pointer(), parts[i].length);
+    off += parts[i].length;
+  }
+  return b;
+}
+
+/*
+ * --cmd pipeline defsdir infile outfile [infile outfile ...] builds each
+ * program with cjsawk, m0 and hex2 in this one shell.  Each stage's output
+ * reaches the next as an in-memory file, the defs and ELF header in defsdir
+ * are read once for all programs, and only the executables are written.
+ */
+function pipeline(defs, files) {
+  var i;
+  for(i = 0; i + 1 < files.length; i += 2) {
+    vfs["pipeline.M1"] = concat_bytes([
+      prefix_bytes(defs + "/simple_asm_defs.M1"),
+      prefix_bytes(defs + "/x86_defs.M1"),
+      prefix_bytes(defs + "/libc-core.M1"),
+      run_stage("cjsawk", files[i])]);
+    vfs["pipeline.hex2"] = concat_bytes([
+      prefix_bytes(defs + "/ELF-i386.hex2"),
+      run_stage("m0", "pipeline.M1")]);
+    write_file(files[i + 1], run_stage("hex2", "pipeline.hex2"));
+  }
+}
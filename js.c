@@ -256,6 +256,9 @@ extern char     *readline(const char *prompt);
 extern void     add_history(char *line);
 #endif
 
+#include "js_cache.c"
+#include "js_gc.c"
+
 static JSBool
 GetLine(JSContext *cx, char *bufp, FILE *file, const char *prompt) {
 #ifdef EDITLINE
@@ -348,7 +351,7 @@ Process(JSContext *cx, JSObject *obj, char *filename)
             }
         }
         ungetc(ch, file);
-        script = JS_CompileFileHandle(cx, obj, filename, file);
+        script = CompileFileCached(cx, obj, filename, file);
         if (script) {
             (void)JS_ExecuteScript(cx, obj, script, &result);
             JS_DestroyScript(cx, script);
@@ -408,7 +411,7 @@ static int
 usage(void)
 {
     fprintf(gErrFile, "%s\n", JS_GetImplementationVersion());
-    fprintf(gErrFile, "usage: js [-PswW] [-b branchlimit] [-c stackchunksize] [-v version] [-f scriptfile] [-S maxstacksize] [scriptfile] [scriptarg...]\n");
+    fprintf(gErrFile, "usage: js [-PswW] [-b branchlimit] [-c stackchunksize] [-v version] [-f scriptfile] [-S maxstacksize] [--script-cache dir] [--gc-max-bytes n] [--gc-trigger ratio] [--gc-interval ms] [--gc-policy fixed|adaptive] [--gc-stats file] [scriptfile] [scriptarg...]\n");
     return 2;
 }
 
@@ -426,9 +429,7 @@ my_BranchCallback(JSContext *cx, JSScript *script)
         gBranchCount = 0;
         return JS_FALSE;
     }
-    if ((gBranchCount & 0x3fff) == 1)
-        JS_MaybeGC(cx);
-    return JS_TRUE;
+    return GCBranchCallback(cx, script);
 }
 
 extern JSClass global_class;
@@ -458,6 +459,7 @@ ProcessArgs(JSContext *cx, JSObject *obj, char **argv, int argc)
           case 'f':
           case 'v':
           case 'S':
+          case '-':
             ++i;
             break;
         }
@@ -561,6 +563,15 @@ ProcessArgs(JSContext *cx, JSObject *obj, char **argv, int argc)
             gMaxStackSize = atoi(argv[i]);
             break;
 
+        case '-':
+            if (++i == argc)
+                return usage();
+            if (!strcmp(argv[i - 1], "--script-cache"))
+                gScriptCacheDir = argv[i];
+            else if (!GCPolicyOption(cx, argv[i - 1], argv[i]))
+                return usage();
+            break;
+
         default:
             return usage();
         }
@@ -674,7 +685,7 @@ Load(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
         older = JS_SetErrorReporter(cx, my_LoadErrorReporter);
         oldopts = JS_GetOptions(cx);
         JS_SetOptions(cx, oldopts | JSOPTION_COMPILE_N_GO);
-        script = JS_CompileFile(cx, obj, filename);
+        script = CompileFileCached(cx, obj, filename, NULL);
         if (!script) {
             ok = JS_FALSE;
         } else {
@@ -1518,6 +1529,7 @@ static JSFunctionSpec shell_functions[] = {
     {"help",            Help,           0},
     {"quit",            Quit,           0},
     {"gc",              GC,             0},
+    {"gcStats",         gcStats,        1},
     {"trap",            Trap,           3},
     {"untrap",          Untrap,         2},
     {"line2pc",         LineToPC,       0},
@@ -1553,6 +1565,7 @@ static char *shell_help_messages[] = {
     "help([name ...])       Display usage and help messages",
     "quit()                 Quit the shell",
     "gc()                   Run the garbage collector",
+    "gcStats([print])       Get (and print) GC pause and heap statistics",
     "trap([fun, [pc,]] exp) Trap bytecode execution",
     "untrap(fun[, pc])      Remove a trap",
     "line2pc([fun,] line)   Map line number to PC",
@@ -2318,6 +2331,8 @@ poke32(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
   return JS_TRUE;
 }
 
+#include "js_ffi.c"
+
 int
 main(int argc, char **argv, char **envp)
 {
@@ -2390,7 +2405,8 @@ main(int argc, char **argv, char **envp)
     argc--;
     argv++;
 
-    rt = JS_NewRuntime(64L * 1024L * 1024L);
+    GCPolicyFromEnvironment();
+    rt = JS_NewRuntime(gGCPolicy.maxBytes);
     if (!rt)
         return 1;
 
@@ -2398,6 +2414,7 @@ main(int argc, char **argv, char **envp)
     if (!cx)
         return 1;
     JS_SetErrorReporter(cx, my_ErrorReporter);
+    GCPolicyInstall(cx);
 
     glob = JS_NewObject(cx, &global_class, NULL, NULL);
     if (!glob)
@@ -2478,6 +2495,95 @@ main(int argc, char **argv, char **envp)
     if (!JS_DefineFunction(cx, glob, "ffi_call", ffi_call, 9, 0))
         return 1;
 
+    if (!JS_DefineFunction(cx, glob, "ffi_bind", ffi_bind, 2, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "ffi_batch", ffi_batch, 1, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "memcpy", heap_memcpy, 3, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "memmove", heap_memmove, 3, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "memset", heap_memset, 3, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "copyArrayToHeap", copyArrayToHeap, 4, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "copyHeapToArray", copyHeapToArray, 4, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "copyStringToHeap", copyStringToHeap, 2, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "copyHeapToString", copyHeapToString, 2, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "peek8u", peek8u, 1, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "peek8s", peek8s, 1, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "peek16u", peek16u, 1, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "peek16s", peek16s, 1, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "peek32u", peek32u, 1, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "peek32s", peek32s, 1, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "poke8u", poke8x, 2, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "poke8s", poke8x, 2, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "poke16u", poke16x, 2, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "poke16s", poke16x, 2, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "poke32u", poke32x, 2, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "poke32s", poke32x, 2, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "heap_region", heap_region, 1, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "readBytes", readBytes, 3, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "writeFile", writeFile, 5, 0))
+        return 1;
+
+#ifndef _WIN32
+    if (!JS_DefineFunction(cx, glob, "mapFile", mapFile, 2, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "mapOutputFile", mapOutputFile, 2, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "heapSnapshot", heapSnapshot, 4, 0))
+        return 1;
+
+    if (!JS_DefineFunction(cx, glob, "heapRestore", heapRestore, 3, 0))
+        return 1;
+#endif
+
+    if (!InitByteBufferClass(cx, glob))
+        return 1;
+
     if (!JS_DefineFunction(cx, glob, "peek8", peek8, 0, 0))
         return 1;
 
@@ -2508,6 +2614,7 @@ main(int argc, char **argv, char **envp)
 #endif
 
     result = ProcessArgs(cx, glob, argv, argc);
+    GCStatsReport(cx);
 
 #ifdef JSDEBUGGER
     if (_jsdc)
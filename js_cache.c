@@ -0,0 +1,471 @@
+/*
+ * Compiled script cache shared by js.c and js_min.c.
+ *
+ * modifications (C) Liam Wilson 2025 under the same license as js.c
+ *
+ * With --script-cache DIR, scripts compiled for Process() and load() are
+ * XDR-serialized into DIR and deserialized on later runs instead of being
+ * parsed again.  An entry is named by a hash of the script's path and
+ * content and carries a header recording the shell build, compile options,
+ * file size, mtime and content hash; any mismatch is a miss.  Entries are
+ * written to a per-process temporary and renamed into place, so concurrent
+ * shells sharing a cache only ever see complete entries.  Cache failures
+ * are never errors: the script is simply compiled as usual.
+ *
+ * A shell image built with -DEMBEDDED_SCRIPTS (see mk_image) also links in
+ * a table of precompiled scripts, and any script whose base name is in that
+ * table is decoded from it without touching the filesystem at all.
+ *
+ * A resident shell (--serve, see js_serve.c) turns on gScriptMemCache, which
+ * keeps the XDR data of each script it compiles in memory keyed by the
+ * file's identity, so a later job decodes an unchanged script without
+ * reading it.
+ *
+ * Worker threads (js_worker.c) compile through here too, so the in-memory
+ * cache and the temporary names are guarded by gScriptCacheLock.
+ */
+
+#include <sys/stat.h>
+#include "jsxdrapi.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+
+static pthread_mutex_t gScriptCacheLock = PTHREAD_MUTEX_INITIALIZER;
+#define ScriptCacheLock()       pthread_mutex_lock(&gScriptCacheLock)
+#define ScriptCacheUnlock()     pthread_mutex_unlock(&gScriptCacheLock)
+#else
+#define ScriptCacheLock()       ((void) 0)
+#define ScriptCacheUnlock()     ((void) 0)
+#endif
+
+static const char *gScriptCacheDir = NULL;
+
+/*
+ * A JS_smprintf'd name beside path for writing it atomically, unique to this
+ * process and, through the sequence number, to this thread.
+ */
+static char *
+TempPathFor(const char *path)
+{
+    static unsigned long seq = 0;
+    unsigned long n;
+
+    ScriptCacheLock();
+    n = seq++;
+    ScriptCacheUnlock();
+    return JS_smprintf("%s.%ld.%lu.tmp", path, (long) getpid(), n);
+}
+
+/* Must match the declaration written by EmbedScripts in js_min.c. */
+typedef struct EmbeddedScript {
+    const char          *name;
+    const unsigned char *data;
+    unsigned int        length;
+} EmbeddedScript;
+
+#ifdef EMBEDDED_SCRIPTS
+extern const EmbeddedScript embedded_scripts[];
+static const EmbeddedScript *gEmbeddedScripts = embedded_scripts;
+#else
+static const EmbeddedScript *gEmbeddedScripts = NULL;
+#endif
+
+static const char *
+ScriptBaseName(const char *path)
+{
+    const char *s;
+
+    for (s = path; *s; s++) {
+        if (*s == '/' || *s == '\\')
+            path = s + 1;
+    }
+    return path;
+}
+
+static const EmbeddedScript *
+FindEmbeddedScript(const char *filename)
+{
+    const EmbeddedScript *es;
+    const char *base;
+
+    if (!gEmbeddedScripts || !filename)
+        return NULL;
+    base = ScriptBaseName(filename);
+    for (es = gEmbeddedScripts; es->name; es++) {
+        if (!strcmp(es->name, base))
+            return es;
+    }
+    return NULL;
+}
+
+/* Decode an XDR-serialized script from length bytes at data. */
+static JSScript *
+DecodeScript(JSContext *cx, const void *data, uint32 length)
+{
+    JSXDRState *xdr;
+    JSScript *script;
+    JSBool ok;
+
+    xdr = JS_XDRNewMem(cx, JSXDR_DECODE);
+    if (!xdr)
+        return NULL;
+    script = NULL;
+    JS_XDRMemSetData(xdr, (void *) data, length);
+    ok = JS_XDRScript(xdr, &script);
+    JS_XDRMemSetData(xdr, NULL, 0);     /* data is still the caller's */
+    JS_XDRDestroy(xdr);
+    return ok ? script : NULL;
+}
+
+#define SCRIPT_CACHE_MAGIC      0x4358534a      /* "JSXC" */
+#define SCRIPT_CACHE_VERSION    1
+
+typedef struct ScriptCacheHeader {
+    uint32      magic;
+    uint32      version;
+    uint32      build;          /* hash of engine version and shell build */
+    uint32      options;        /* JS_GetOptions at compile time */
+    uint32      size;
+    uint32      mtime;
+    uint32      hash;           /* of the source text */
+    uint32      length;         /* of the XDR data that follows */
+} ScriptCacheHeader;
+
+/* 32-bit FNV-1a. */
+static uint32
+ScriptCacheHash(uint32 h, const void *p, size_t n)
+{
+    const unsigned char *s = (const unsigned char *) p;
+
+    while (n-- > 0) {
+        h ^= *s++;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+#define SCRIPT_CACHE_HASH_INIT  2166136261U
+
+static uint32
+ScriptCacheBuildId(void)
+{
+    static const char shell_build[] = __DATE__ " " __TIME__;
+    const char *engine;
+    uint32 h;
+
+    engine = JS_GetImplementationVersion();
+    h = ScriptCacheHash(SCRIPT_CACHE_HASH_INIT, engine, strlen(engine));
+    return ScriptCacheHash(h, shell_build, sizeof shell_build);
+}
+
+/* Read the rest of file into a JS_malloc'd buffer. */
+static char *
+ScriptCacheSlurp(JSContext *cx, FILE *file, size_t *lenp)
+{
+    char *buf, *tmp;
+    size_t len, cap, cc;
+
+    len = 0;
+    cap = 8192;
+    buf = (char *) JS_malloc(cx, cap);
+    if (!buf)
+        return NULL;
+    while ((cc = fread(buf + len, 1, cap - len, file)) > 0) {
+        len += cc;
+        if (len == cap) {
+            cap *= 2;
+            tmp = (char *) JS_realloc(cx, buf, cap);
+            if (!tmp) {
+                JS_free(cx, buf);
+                return NULL;
+            }
+            buf = tmp;
+        }
+    }
+    *lenp = len;
+    return buf;
+}
+
+static JSScript *
+ScriptCacheLoad(JSContext *cx, const char *cachePath,
+                const ScriptCacheHeader *want)
+{
+    FILE *cf;
+    ScriptCacheHeader hdr;
+    void *data;
+    JSScript *script;
+
+    cf = fopen(cachePath, "rb");
+    if (!cf)
+        return NULL;
+    script = NULL;
+    data = NULL;
+    if (fread(&hdr, sizeof hdr, 1, cf) != 1 ||
+        hdr.magic != want->magic || hdr.version != want->version ||
+        hdr.build != want->build || hdr.options != want->options ||
+        hdr.size != want->size || hdr.mtime != want->mtime ||
+        hdr.hash != want->hash) {
+        goto out;
+    }
+    data = JS_malloc(cx, hdr.length);
+    if (!data || fread(data, 1, hdr.length, cf) != hdr.length)
+        goto out;
+
+    script = DecodeScript(cx, data, hdr.length);
+    if (!script) {
+        /* A stale or damaged entry: recompile quietly. */
+        JS_ClearPendingException(cx);
+    }
+
+  out:
+    if (data)
+        JS_free(cx, data);
+    fclose(cf);
+    return script;
+}
+
+static void
+ScriptCacheStore(JSContext *cx, const char *cachePath, JSScript *script,
+                 ScriptCacheHeader *hdr)
+{
+    JSXDRState *xdr;
+    void *data;
+    uint32 length;
+    char *tmp;
+    FILE *cf;
+    JSBool ok;
+
+    xdr = JS_XDRNewMem(cx, JSXDR_ENCODE);
+    if (!xdr)
+        return;
+    if (!JS_XDRScript(xdr, &script)) {
+        JS_ClearPendingException(cx);
+        JS_XDRDestroy(xdr);
+        return;
+    }
+    data = JS_XDRMemGetData(xdr, &length);
+    hdr->length = length;
+
+    tmp = TempPathFor(cachePath);
+    if (tmp) {
+        cf = fopen(tmp, "wb");
+        if (cf) {
+            ok = fwrite(hdr, sizeof *hdr, 1, cf) == 1 &&
+                 fwrite(data, 1, length, cf) == length;
+            ok = (fclose(cf) == 0) && ok;
+            if (!ok || rename(tmp, cachePath) != 0)
+                remove(tmp);
+        }
+        JS_smprintf_free(tmp);
+    }
+    JS_XDRDestroy(xdr);
+}
+
+typedef struct ScriptMemEntry {
+    struct ScriptMemEntry *next;
+    dev_t       dev;
+    ino_t       ino;
+    off_t       size;
+    time_t      mtime;
+    uint32      options;
+    uint32      length;
+    void        *data;          /* malloc'd XDR data */
+} ScriptMemEntry;
+
+static JSBool gScriptMemCache = JS_FALSE;
+static ScriptMemEntry *gScriptMemEntries = NULL;
+
+/* Call with gScriptCacheLock held. */
+static ScriptMemEntry *
+ScriptMemLookup(const struct stat *sb)
+{
+    ScriptMemEntry *e;
+
+    for (e = gScriptMemEntries; e; e = e->next) {
+        if (e->dev == sb->st_dev && e->ino == sb->st_ino)
+            return e;
+    }
+    return NULL;
+}
+
+static void
+ScriptMemStore(JSContext *cx, const struct stat *sb, JSScript *script)
+{
+    JSXDRState *xdr;
+    ScriptMemEntry *e;
+    void *data, *copy;
+    uint32 length;
+
+    xdr = JS_XDRNewMem(cx, JSXDR_ENCODE);
+    if (!xdr)
+        return;
+    if (!JS_XDRScript(xdr, &script)) {
+        JS_ClearPendingException(cx);
+        JS_XDRDestroy(xdr);
+        return;
+    }
+    data = JS_XDRMemGetData(xdr, &length);
+    copy = malloc(length);
+    if (copy) {
+        memcpy(copy, data, length);
+        ScriptCacheLock();
+        e = ScriptMemLookup(sb);
+        if (!e) {
+            e = (ScriptMemEntry *) calloc(1, sizeof *e);
+            if (e) {
+                e->next = gScriptMemEntries;
+                gScriptMemEntries = e;
+            }
+        }
+        if (e) {
+            free(e->data);
+            e->dev = sb->st_dev;
+            e->ino = sb->st_ino;
+            e->size = sb->st_size;
+            e->mtime = sb->st_mtime;
+            e->options = JS_GetOptions(cx);
+            e->length = length;
+            e->data = copy;
+            copy = NULL;
+        }
+        ScriptCacheUnlock();
+        free(copy);
+    }
+    JS_XDRDestroy(xdr);
+}
+
+/*
+ * Compile the len bytes of source at buf, read from filename as described by
+ * sb, through the on-disk cache.  The caller keeps buf.
+ */
+static JSScript *
+CompileSourceStored(JSContext *cx, JSObject *obj, const char *filename,
+                    const struct stat *sb, const char *buf, size_t len)
+{
+    ScriptCacheHeader hdr;
+    char *cachePath;
+    uint32 pathHash;
+    JSScript *script;
+
+    memset(&hdr, 0, sizeof hdr);
+    hdr.magic = SCRIPT_CACHE_MAGIC;
+    hdr.version = SCRIPT_CACHE_VERSION;
+    hdr.build = ScriptCacheBuildId();
+    hdr.options = JS_GetOptions(cx);
+    hdr.size = (uint32) sb->st_size;
+    hdr.mtime = (uint32) sb->st_mtime;
+    hdr.hash = ScriptCacheHash(SCRIPT_CACHE_HASH_INIT, buf, len);
+    pathHash = ScriptCacheHash(SCRIPT_CACHE_HASH_INIT, filename,
+                               strlen(filename));
+
+    cachePath = gScriptCacheDir
+                ? JS_smprintf("%s/%08x-%08x.jsc", gScriptCacheDir,
+                              pathHash, hdr.hash)
+                : NULL;
+    script = cachePath ? ScriptCacheLoad(cx, cachePath, &hdr) : NULL;
+    if (!script) {
+        script = JS_CompileScript(cx, obj, buf, len, filename, 1);
+        if (script && cachePath)
+            ScriptCacheStore(cx, cachePath, script, &hdr);
+    }
+    if (cachePath)
+        JS_smprintf_free(cachePath);
+    return script;
+}
+
+/* Compile filename or file through the on-disk cache, if there is one. */
+static JSScript *
+CompileFileStored(JSContext *cx, JSObject *obj, const char *filename,
+                  FILE *file)
+{
+    FILE *own;
+    struct stat sb;
+    char *buf;
+    size_t len;
+    JSScript *script;
+
+    if (!gScriptCacheDir) {
+        return file ? JS_CompileFileHandle(cx, obj, filename, file)
+                    : JS_CompileFile(cx, obj, filename);
+    }
+
+    own = NULL;
+    if (!file) {
+        own = file = fopen(filename, "rb");
+        if (!file)
+            return JS_CompileFile(cx, obj, filename);   /* reports the error */
+    }
+    if (fstat(fileno(file), &sb) < 0) {
+        script = JS_CompileFileHandle(cx, obj, filename, file);
+        goto out;
+    }
+    buf = ScriptCacheSlurp(cx, file, &len);
+    if (!buf) {
+        script = NULL;
+        goto out;
+    }
+    script = CompileSourceStored(cx, obj, filename, &sb, buf, len);
+    JS_free(cx, buf);
+
+  out:
+    if (own)
+        fclose(own);
+    return script;
+}
+
+/*
+ * Compile filename, or the rest of file if it is not NULL, taking it from
+ * the embedded table or the script caches when possible.
+ */
+static JSScript *
+CompileFileCached(JSContext *cx, JSObject *obj, const char *filename,
+                  FILE *file)
+{
+    struct stat sb;
+    ScriptMemEntry *e;
+    JSScript *script;
+    const EmbeddedScript *es;
+    void *data;
+    uint32 length;
+    int rv;
+
+    es = FindEmbeddedScript(filename);
+    if (es) {
+        script = DecodeScript(cx, es->data, es->length);
+        if (!script && !JS_IsExceptionPending(cx))
+            JS_ReportError(cx, "can't decode embedded script %s", es->name);
+        return script;
+    }
+
+    if (!gScriptMemCache)
+        return CompileFileStored(cx, obj, filename, file);
+
+    rv = file ? fstat(fileno(file), &sb) : stat(filename, &sb);
+    if (rv < 0)
+        return CompileFileStored(cx, obj, filename, file);
+
+    /* Decode a copy, as another thread may replace the entry meanwhile. */
+    data = NULL;
+    ScriptCacheLock();
+    e = ScriptMemLookup(&sb);
+    if (e && e->size == sb.st_size && e->mtime == sb.st_mtime &&
+        e->options == JS_GetOptions(cx)) {
+        length = e->length;
+        data = malloc(length);
+        if (data)
+            memcpy(data, e->data, length);
+    }
+    ScriptCacheUnlock();
+    if (data) {
+        script = DecodeScript(cx, data, length);
+        free(data);
+        if (script)
+            return script;
+        JS_ClearPendingException(cx);
+    }
+    script = CompileFileStored(cx, obj, filename, file);
+    if (script)
+        ScriptMemStore(cx, &sb, script);
+    return script;
+}
@@ -0,0 +1,129 @@
+/*
+ * Thin client for a shell started with --serve SOCKET (see js_serve.c).
+ *
+ * modifications (C) Liam Wilson 2025 under the same license as js.c
+ *
+ *     js_client.exe SOCKET [--script-cache DIR] scriptfile [scriptarg...]
+ *
+ * runs the rest of its command line in the server as if it were
+ * js_min.exe's, in the current directory and with the client's own stdin,
+ * stdout and stderr, and exits with the job's exit code.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Must match js_serve.c. */
+#define SERVE_MAGIC             0x424a534a      /* "JSJB" */
+#define SERVE_MAX_REQUEST       (1 << 20)
+
+typedef struct ServeRequest {
+    uint32_t    magic;
+    uint32_t    length;         /* of the NUL-terminated cwd and arguments */
+} ServeRequest;
+
+static int
+fail(const char *what, const char *detail)
+{
+    fprintf(stderr, "js_client: %s %s: %s\n", what, detail, strerror(errno));
+    return 1;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    ServeRequest req;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    int fds[3] = {0, 1, 2};
+    char cwd[4096], *buf, *p;
+    size_t length, n;
+    ssize_t cc;
+    int fd, i;
+    int32_t status;
+
+    if (argc < 3) {
+        fprintf(stderr, "usage: js_client SOCKET [--script-cache DIR] "
+                        "scriptfile [scriptarg...]\n");
+        return 2;
+    }
+    if (!getcwd(cwd, sizeof cwd))
+        return fail("can't get", "working directory");
+
+    length = strlen(cwd) + 1;
+    for (i = 2; i < argc; i++)
+        length += strlen(argv[i]) + 1;
+    if (length > SERVE_MAX_REQUEST) {
+        fprintf(stderr, "js_client: command line too long\n");
+        return 2;
+    }
+    buf = (char *) malloc(length);
+    if (!buf)
+        return fail("out of", "memory");
+    p = buf;
+    n = strlen(cwd) + 1;
+    memcpy(p, cwd, n);
+    p += n;
+    for (i = 2; i < argc; i++) {
+        n = strlen(argv[i]) + 1;
+        memcpy(p, argv[i], n);
+        p += n;
+    }
+
+    if (strlen(argv[1]) >= sizeof addr.sun_path) {
+        fprintf(stderr, "js_client: socket path too long: %s\n", argv[1]);
+        return 2;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, argv[1]);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof addr) < 0)
+        return fail("can't connect to", argv[1]);
+
+    /* The header carries our standard fds; the arguments follow. */
+    req.magic = SERVE_MAGIC;
+    req.length = (uint32_t) length;
+    memset(&msg, 0, sizeof msg);
+    memset(&control, 0, sizeof control);
+    iov.iov_base = &req;
+    iov.iov_len = sizeof req;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof control.buf;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof fds);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof fds);
+    if (sendmsg(fd, &msg, 0) != sizeof req)
+        return fail("can't send to", argv[1]);
+    for (p = buf; p < buf + length; p += cc) {
+        cc = write(fd, p, buf + length - p);
+        if (cc < 0)
+            return fail("can't send to", argv[1]);
+    }
+
+    for (n = 0; n < sizeof status; n += cc) {
+        cc = read(fd, (char *) &status + n, sizeof status - n);
+        if (cc <= 0) {
+            fprintf(stderr, "js_client: %s: job ended without an exit code\n",
+                    argv[1]);
+            return 1;
+        }
+    }
+    return status;
+}
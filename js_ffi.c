@@ -0,0 +1,2137 @@
+/*
+ * Native helpers shared by js.c and js_min.c.
+ *
+ * modifications (C) Liam Wilson 2025 under the same license as js.c
+ *
+ * Everything here assumes the i386 cdecl ABI that ffi_call already relies
+ * on: pointers fit in an int and every argument occupies whole 32-bit stack
+ * words.
+ */
+
+#include <stdint.h>
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+/*
+ * Bound FFI functions.
+ *
+ * ffi_bind(ptr, sig) returns a callable object that carries the function
+ * pointer and its parsed signature, so a call converts only the declared
+ * arguments and dispatches straight to a stub of the right arity.  sig is
+ * the return type followed by the argument types in parentheses, e.g.
+ * "p(ii)" for calloc or "v(p)" for free:
+ *
+ *   i  int                   (ToInt32, wraps like C)
+ *   p  pointer               (number or ByteBuffer, null/undefined for 0)
+ *   s  string                (passed as a NUL terminated char *; a
+ *                             number is taken as a char * as-is)
+ *   d  double                (two stack words)
+ *   v  void                  (return type only)
+ *
+ * Integer results come back as tagged ints whenever they fit in a jsval.
+ */
+
+#define FFI_MAX_WORDS 8
+
+typedef int (*ffi_int_stub)(void *fn, int *a);
+typedef double (*ffi_double_stub)(void *fn, int *a);
+
+typedef struct FFIFunction {
+    void            *fn;
+    uint8_t         nargs;          /* number of JS arguments */
+    uint8_t         nwords;         /* number of 32-bit stack words */
+    char            ret;            /* 'i', 'p', 'v' or 'd' */
+    char            args[FFI_MAX_WORDS];
+    ffi_int_stub    icall;
+    ffi_double_stub dcall;
+} FFIFunction;
+
+typedef int (*ffi_fn0)(void);
+typedef int (*ffi_fn1)(int);
+typedef int (*ffi_fn2)(int, int);
+typedef int (*ffi_fn3)(int, int, int);
+typedef int (*ffi_fn4)(int, int, int, int);
+typedef int (*ffi_fn5)(int, int, int, int, int);
+typedef int (*ffi_fn6)(int, int, int, int, int, int);
+typedef int (*ffi_fn7)(int, int, int, int, int, int, int);
+typedef int (*ffi_fn8)(int, int, int, int, int, int, int, int);
+
+static int ffi_i0(void *f, int *a) { return ((ffi_fn0)f)(); }
+static int ffi_i1(void *f, int *a) { return ((ffi_fn1)f)(a[0]); }
+static int ffi_i2(void *f, int *a) { return ((ffi_fn2)f)(a[0], a[1]); }
+static int ffi_i3(void *f, int *a) { return ((ffi_fn3)f)(a[0], a[1], a[2]); }
+static int ffi_i4(void *f, int *a) { return ((ffi_fn4)f)(a[0], a[1], a[2], a[3]); }
+static int ffi_i5(void *f, int *a) { return ((ffi_fn5)f)(a[0], a[1], a[2], a[3], a[4]); }
+static int ffi_i6(void *f, int *a) { return ((ffi_fn6)f)(a[0], a[1], a[2], a[3], a[4], a[5]); }
+static int ffi_i7(void *f, int *a) { return ((ffi_fn7)f)(a[0], a[1], a[2], a[3], a[4], a[5], a[6]); }
+static int ffi_i8(void *f, int *a) { return ((ffi_fn8)f)(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]); }
+
+static ffi_int_stub ffi_int_stubs[] = {
+    ffi_i0, ffi_i1, ffi_i2, ffi_i3, ffi_i4, ffi_i5, ffi_i6, ffi_i7, ffi_i8
+};
+
+typedef double (*ffi_dfn0)(void);
+typedef double (*ffi_dfn1)(int);
+typedef double (*ffi_dfn2)(int, int);
+typedef double (*ffi_dfn3)(int, int, int);
+typedef double (*ffi_dfn4)(int, int, int, int);
+typedef double (*ffi_dfn5)(int, int, int, int, int);
+typedef double (*ffi_dfn6)(int, int, int, int, int, int);
+typedef double (*ffi_dfn7)(int, int, int, int, int, int, int);
+typedef double (*ffi_dfn8)(int, int, int, int, int, int, int, int);
+
+static double ffi_d0(void *f, int *a) { return ((ffi_dfn0)f)(); }
+static double ffi_d1(void *f, int *a) { return ((ffi_dfn1)f)(a[0]); }
+static double ffi_d2(void *f, int *a) { return ((ffi_dfn2)f)(a[0], a[1]); }
+static double ffi_d3(void *f, int *a) { return ((ffi_dfn3)f)(a[0], a[1], a[2]); }
+static double ffi_d4(void *f, int *a) { return ((ffi_dfn4)f)(a[0], a[1], a[2], a[3]); }
+static double ffi_d5(void *f, int *a) { return ((ffi_dfn5)f)(a[0], a[1], a[2], a[3], a[4]); }
+static double ffi_d6(void *f, int *a) { return ((ffi_dfn6)f)(a[0], a[1], a[2], a[3], a[4], a[5]); }
+static double ffi_d7(void *f, int *a) { return ((ffi_dfn7)f)(a[0], a[1], a[2], a[3], a[4], a[5], a[6]); }
+static double ffi_d8(void *f, int *a) { return ((ffi_dfn8)f)(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]); }
+
+static ffi_double_stub ffi_double_stubs[] = {
+    ffi_d0, ffi_d1, ffi_d2, ffi_d3, ffi_d4, ffi_d5, ffi_d6, ffi_d7, ffi_d8
+};
+
+/* See ByteBuffer below; declared here so FFI calls can take buffers. */
+typedef struct ByteBuffer ByteBuffer;
+static JSClass bytebuffer_class;
+static uint8_t *ByteBufferData(ByteBuffer *bb);
+
+/*
+ * Convert v to an int the way C would see it, without a GC allocation.  A
+ * ByteBuffer converts to the address of its first byte.
+ */
+static JSBool
+ffi_ValueToInt(JSContext *cx, jsval v, int *ip)
+{
+    ByteBuffer *bb;
+
+    if (JSVAL_IS_INT(v)) {
+        *ip = JSVAL_TO_INT(v);
+        return JS_TRUE;
+    }
+    if (JSVAL_IS_NULL(v) || JSVAL_IS_VOID(v)) {
+        *ip = 0;
+        return JS_TRUE;
+    }
+    if (!JSVAL_IS_PRIMITIVE(v) &&
+        JS_GET_CLASS(cx, JSVAL_TO_OBJECT(v)) == &bytebuffer_class) {
+        bb = (ByteBuffer *) JS_GetPrivate(cx, JSVAL_TO_OBJECT(v));
+        *ip = bb ? (int) ByteBufferData(bb) : 0;
+        return JS_TRUE;
+    }
+    return JS_ValueToECMAInt32(cx, v, (int32 *)ip);
+}
+
+/* Box an int result, keeping it a tagged int whenever it fits. */
+static JSBool
+ffi_IntToValue(JSContext *cx, int i, jsval *vp)
+{
+    if (INT_FITS_IN_JSVAL(i)) {
+        *vp = INT_TO_JSVAL(i);
+        return JS_TRUE;
+    }
+    return JS_NewDoubleValue(cx, (jsdouble)i, vp);
+}
+
+static void
+ffi_function_finalize(JSContext *cx, JSObject *obj)
+{
+    FFIFunction *ff;
+
+    ff = (FFIFunction *) JS_GetPrivate(cx, obj);
+    if (ff)
+        JS_free(cx, ff);
+}
+
+static JSBool
+ffi_function_call(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                  jsval *rval);
+
+static JSClass ffi_function_class = {
+    "FFIFunction", JSCLASS_HAS_PRIVATE,
+    JS_PropertyStub,  JS_PropertyStub,
+    JS_PropertyStub,  JS_PropertyStub,
+    JS_EnumerateStub, JS_ResolveStub,
+    JS_ConvertStub,   ffi_function_finalize,
+    NULL,             NULL,
+    ffi_function_call
+};
+
+static JSBool
+ffi_function_call(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                  jsval *rval)
+{
+    FFIFunction *ff;
+    JSString *str;
+    jsdouble d;
+    int words[FFI_MAX_WORDS];
+    uintN i, w;
+
+    /* The callee is the bound object itself, not |this|. */
+    ff = (FFIFunction *) JS_GetPrivate(cx, JSVAL_TO_OBJECT(argv[-2]));
+    if (!ff)
+        return JS_FALSE;
+
+    for (i = w = 0; i < ff->nargs; i++) {
+        jsval v = (i < argc) ? argv[i] : JSVAL_VOID;
+
+        switch (ff->args[i]) {
+          case 'i':
+          case 'p':
+            if (!ffi_ValueToInt(cx, v, &words[w++]))
+                return JS_FALSE;
+            break;
+
+          case 's':
+            /* Numbers and ByteBuffers are already char pointers. */
+            if ((JSVAL_IS_PRIMITIVE(v) && !JSVAL_IS_STRING(v)) ||
+                (!JSVAL_IS_PRIMITIVE(v) &&
+                 JS_GET_CLASS(cx, JSVAL_TO_OBJECT(v)) == &bytebuffer_class)) {
+                if (!ffi_ValueToInt(cx, v, &words[w++]))
+                    return JS_FALSE;
+                break;
+            }
+            str = JS_ValueToString(cx, v);
+            if (!str)
+                return JS_FALSE;
+            if (i < argc)
+                argv[i] = STRING_TO_JSVAL(str);     /* keep it rooted */
+            words[w++] = (int) JS_GetStringBytes(str);
+            break;
+
+          case 'd':
+            if (!JS_ValueToNumber(cx, v, &d))
+                return JS_FALSE;
+            memcpy(&words[w], &d, sizeof d);
+            w += 2;
+            break;
+        }
+    }
+
+    switch (ff->ret) {
+      case 'v':
+        ff->icall(ff->fn, words);
+        *rval = JSVAL_VOID;
+        return JS_TRUE;
+      case 'd':
+        return JS_NewNumberValue(cx, ff->dcall(ff->fn, words), rval);
+      default:
+        return ffi_IntToValue(cx, ff->icall(ff->fn, words), rval);
+    }
+}
+
+static JSBool
+ffi_bind(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
+{
+    int ptr;
+    JSString *str;
+    const char *sig, *s;
+    FFIFunction *ff;
+    JSObject *fobj;
+
+    if (argc < 2 || !JSVAL_IS_NUMBER(argv[0])) {
+        JS_ReportError(cx, "usage: ffi_bind(ptr, signature)");
+        return JS_FALSE;
+    }
+    if (!ffi_ValueToInt(cx, argv[0], &ptr))
+        return JS_FALSE;
+    str = JS_ValueToString(cx, argv[1]);
+    if (!str)
+        return JS_FALSE;
+    argv[1] = STRING_TO_JSVAL(str);
+    sig = JS_GetStringBytes(str);
+
+    ff = (FFIFunction *) JS_malloc(cx, sizeof *ff);
+    if (!ff)
+        return JS_FALSE;
+    memset(ff, 0, sizeof *ff);
+    ff->fn = (void *) ptr;
+
+    s = sig;
+    switch (*s) {
+      case 'i': case 'p': case 'v': case 'd':
+        ff->ret = *s++;
+        break;
+      default:
+        goto bad;
+    }
+    if (*s++ != '(')
+        goto bad;
+    for (; *s && *s != ')'; s++) {
+        switch (*s) {
+          case 'i': case 'p': case 's':
+            ff->nwords++;
+            break;
+          case 'd':
+            ff->nwords += 2;
+            break;
+          default:
+            goto bad;
+        }
+        if (ff->nwords > FFI_MAX_WORDS)
+            goto bad;
+        ff->args[ff->nargs++] = *s;
+    }
+    if (*s != ')' || s[1] != '\0')
+        goto bad;
+
+    ff->icall = ffi_int_stubs[ff->nwords];
+    ff->dcall = ffi_double_stubs[ff->nwords];
+
+    fobj = JS_NewObject(cx, &ffi_function_class, NULL, NULL);
+    if (!fobj || !JS_SetPrivate(cx, fobj, ff)) {
+        JS_free(cx, ff);
+        return JS_FALSE;
+    }
+    *rval = OBJECT_TO_JSVAL(fobj);
+    return JS_TRUE;
+
+  bad:
+    JS_free(cx, ff);
+    JS_ReportError(cx, "ffi_bind: bad signature \"%s\"", sig);
+    return JS_FALSE;
+}
+
+/*
+ * Batched FFI calls.
+ *
+ * ffi_batch(list) runs a whole sequence of native calls in one trip through
+ * the interpreter.  list is a flat array of commands, each laid out as
+ *
+ *   fn, nargs, arg1, ..., argN
+ *
+ * where fn is a function pointer or an ffi_bind result (only its pointer is
+ * used) and each argument is converted like ffi_call does: numbers as ints,
+ * strings as char *, ByteBuffers as their address.  A one element array [k]
+ * stands for the result of command k, so a FILE * from fopen can be forwarded
+ * into later fwrite/fclose commands.  Returns an array of the int results.
+ */
+static JSBool
+ffi_batch(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
+{
+    JSObject *list, *res, *ref;
+    jsuint len, i, n, ncmds;
+    int fn, nargs, k, words[FFI_MAX_WORDS];
+    int *results;
+    jsval v;
+    JSBool ok;
+
+    if (argc < 1 || JSVAL_IS_PRIMITIVE(argv[0]) ||
+        !JS_IsArrayObject(cx, JSVAL_TO_OBJECT(argv[0]))) {
+        JS_ReportError(cx, "usage: ffi_batch([fn, nargs, args..., ...])");
+        return JS_FALSE;
+    }
+    list = JSVAL_TO_OBJECT(argv[0]);
+    if (!JS_GetArrayLength(cx, list, &len))
+        return JS_FALSE;
+
+    /* Every command takes at least two slots. */
+    results = (int *) JS_malloc(cx, (len / 2 + 1) * sizeof(int));
+    if (!results)
+        return JS_FALSE;
+
+    ok = JS_FALSE;
+    ncmds = 0;
+    for (i = 0; i < len; ncmds++) {
+        if (!JS_GetElement(cx, list, i++, &v))
+            goto out;
+        if (!JSVAL_IS_PRIMITIVE(v) &&
+            JS_GET_CLASS(cx, JSVAL_TO_OBJECT(v)) == &ffi_function_class) {
+            fn = (int) ((FFIFunction *)
+                        JS_GetPrivate(cx, JSVAL_TO_OBJECT(v)))->fn;
+        } else if (!ffi_ValueToInt(cx, v, &fn)) {
+            goto out;
+        }
+        if (!JS_GetElement(cx, list, i++, &v) ||
+            !ffi_ValueToInt(cx, v, &nargs)) {
+            goto out;
+        }
+        if (nargs < 0 || nargs > FFI_MAX_WORDS || i + nargs > len) {
+            JS_ReportError(cx, "ffi_batch: bad argument count %d in command %u",
+                           nargs, ncmds);
+            goto out;
+        }
+        for (n = 0; n < (jsuint) nargs; n++) {
+            if (!JS_GetElement(cx, list, i++, &v))
+                goto out;
+            if (JSVAL_IS_STRING(v)) {
+                /* The string stays rooted by list for the whole batch. */
+                words[n] = (int) JS_GetStringBytes(JSVAL_TO_STRING(v));
+            } else if (JSVAL_IS_NUMBER(v)) {
+                if (!ffi_ValueToInt(cx, v, &words[n]))
+                    goto out;
+            } else if (!JSVAL_IS_PRIMITIVE(v) &&
+                       JS_IsArrayObject(cx, ref = JSVAL_TO_OBJECT(v))) {
+                if (!JS_GetElement(cx, ref, 0, &v) ||
+                    !ffi_ValueToInt(cx, v, &k)) {
+                    goto out;
+                }
+                if (k < 0 || (jsuint) k >= ncmds) {
+                    JS_ReportError(cx, "ffi_batch: command %u refers to the "
+                                   "result of command %d", ncmds, k);
+                    goto out;
+                }
+                words[n] = results[k];
+            } else if (!ffi_ValueToInt(cx, v, &words[n])) {
+                goto out;
+            }
+        }
+        results[ncmds] = ffi_int_stubs[nargs]((void *) fn, words);
+    }
+
+    res = JS_NewArrayObject(cx, 0, NULL);
+    if (!res)
+        goto out;
+    *rval = OBJECT_TO_JSVAL(res);
+    for (i = 0; i < ncmds; i++) {
+        if (!ffi_IntToValue(cx, results[i], &v) ||
+            !JS_SetElement(cx, res, i, &v)) {
+            goto out;
+        }
+    }
+    ok = JS_TRUE;
+
+  out:
+    JS_free(cx, results);
+    return ok;
+}
+
+/*
+ * Bulk memory primitives.  Addresses are plain numbers, as for peek/poke.
+ */
+static JSBool
+heap_memcpy(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
+{
+    int dst, src, n;
+
+    if (!JS_ConvertArguments(cx, argc, argv, "iii", &dst, &src, &n))
+        return JS_FALSE;
+    memcpy((void *) dst, (void *) src, (size_t) n);
+    return ffi_IntToValue(cx, dst, rval);
+}
+
+static JSBool
+heap_memmove(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
+{
+    int dst, src, n;
+
+    if (!JS_ConvertArguments(cx, argc, argv, "iii", &dst, &src, &n))
+        return JS_FALSE;
+    memmove((void *) dst, (void *) src, (size_t) n);
+    return ffi_IntToValue(cx, dst, rval);
+}
+
+static JSBool
+heap_memset(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
+{
+    int dst, c, n;
+
+    if (!JS_ConvertArguments(cx, argc, argv, "iii", &dst, &c, &n))
+        return JS_FALSE;
+    memset((void *) dst, c, (size_t) n);
+    return ffi_IntToValue(cx, dst, rval);
+}
+
+/* Store the low bytes of arr[offset .. offset+len) at p. */
+static JSBool
+CopyArrayBytes(JSContext *cx, JSObject *arr, jsuint offset, jsuint len,
+               uint8_t *p)
+{
+    jsuint i;
+    jsval e;
+    int v;
+
+    for (i = 0; i < len; i++) {
+        if (!JS_GetElement(cx, arr, (jsint) (offset + i), &e))
+            return JS_FALSE;
+        if (JSVAL_IS_INT(e)) {
+            p[i] = (uint8_t) JSVAL_TO_INT(e);
+        } else {
+            if (!ffi_ValueToInt(cx, e, &v))
+                return JS_FALSE;
+            p[i] = (uint8_t) v;
+        }
+    }
+    return JS_TRUE;
+}
+
+/* copyArrayToHeap(ptr, array[, offset[, len]]): store array bytes at ptr. */
+static JSBool
+copyArrayToHeap(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                jsval *rval)
+{
+    int ptr;
+    JSObject *arr;
+    jsuint alen, offset, len;
+
+    offset = 0;
+    len = (jsuint) -1;
+    if (!JS_ConvertArguments(cx, argc, argv, "io/uu", &ptr, &arr, &offset,
+                             &len)) {
+        return JS_FALSE;
+    }
+    if (!arr) {
+        JS_ReportError(cx, "copyArrayToHeap: array expected");
+        return JS_FALSE;
+    }
+    if (!JS_GetArrayLength(cx, arr, &alen))
+        return JS_FALSE;
+    if (offset > alen)
+        offset = alen;
+    if (len > alen - offset)
+        len = alen - offset;
+
+    if (!CopyArrayBytes(cx, arr, offset, len, (uint8_t *) ptr))
+        return JS_FALSE;
+    return ffi_IntToValue(cx, (int) len, rval);
+}
+
+/*
+ * copyHeapToArray(ptr, len[, array[, offset]]): load len bytes at ptr into
+ * array (a new one if not given) starting at offset, and return the array.
+ */
+static JSBool
+copyHeapToArray(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                jsval *rval)
+{
+    int ptr;
+    JSObject *arr;
+    jsuint len, offset, i;
+    uint8_t *p;
+    jsval e;
+
+    arr = NULL;
+    offset = 0;
+    if (!JS_ConvertArguments(cx, argc, argv, "iu/ou", &ptr, &len, &arr,
+                             &offset)) {
+        return JS_FALSE;
+    }
+    /* Element ids are ints in a jsval, so the last index must fit one. */
+    if (len != 0 &&
+        (offset > JSVAL_INT_MAX || len - 1 > JSVAL_INT_MAX - offset)) {
+        JS_ReportError(cx, "copyHeapToArray: %lu bytes from index %lu are "
+                       "out of range", (unsigned long) len,
+                       (unsigned long) offset);
+        return JS_FALSE;
+    }
+    if (!arr) {
+        arr = JS_NewArrayObject(cx, 0, NULL);
+        if (!arr)
+            return JS_FALSE;
+    }
+    *rval = OBJECT_TO_JSVAL(arr);
+
+    p = (uint8_t *) ptr;
+    for (i = 0; i < len; i++) {
+        e = INT_TO_JSVAL(p[i]);
+        if (!JS_SetElement(cx, arr, (jsint) (offset + i), &e))
+            return JS_FALSE;
+    }
+    return JS_TRUE;
+}
+
+/*
+ * copyStringToHeap(ptr, str): store the low byte of each char of str at ptr,
+ * followed by a NUL, and return the number of chars stored.
+ */
+static JSBool
+copyStringToHeap(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                 jsval *rval)
+{
+    int ptr;
+    JSString *str;
+    const jschar *s;
+    size_t n, i;
+    uint8_t *p;
+
+    if (!JS_ConvertArguments(cx, argc, argv, "iS", &ptr, &str))
+        return JS_FALSE;
+    s = JS_GetStringChars(str);
+    n = JS_GetStringLength(str);
+    p = (uint8_t *) ptr;
+    for (i = 0; i < n; i++)
+        p[i] = (uint8_t) s[i];
+    p[n] = 0;
+    return ffi_IntToValue(cx, (int) n, rval);
+}
+
+/*
+ * copyHeapToString(ptr[, len]): make a string of len bytes at ptr, or of
+ * the NUL terminated string at ptr if len is omitted.
+ */
+static JSBool
+copyHeapToString(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                 jsval *rval)
+{
+    int ptr, len;
+    JSString *str;
+
+    len = -1;
+    if (!JS_ConvertArguments(cx, argc, argv, "i/i", &ptr, &len))
+        return JS_FALSE;
+    if (len < 0)
+        len = strlen((char *) ptr);
+    str = JS_NewStringCopyN(cx, (char *) ptr, (size_t) len);
+    if (!str)
+        return JS_FALSE;
+    *rval = STRING_TO_JSVAL(str);
+    return JS_TRUE;
+}
+
+/*
+ * Sized heap accessors.  peek8u/8s/16u/16s/32u/32s load and zero or sign
+ * extend; the matching pokes store the low bits of their value.  Tagged int
+ * addresses and values skip number conversion entirely and results come
+ * back as tagged ints unless they don't fit (only large 32-bit ones).
+ */
+#define HEAP_ADDR(cx, v, ap)                                                  \
+    (JSVAL_IS_INT(v) ? (*(ap) = JSVAL_TO_INT(v), JS_TRUE)                     \
+                     : ffi_ValueToInt(cx, v, ap))
+
+#define DEFINE_PEEK(name, type)                                               \
+    static JSBool                                                             \
+    name(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)  \
+    {                                                                         \
+        int a;                                                                \
+                                                                              \
+        if (!HEAP_ADDR(cx, argv[0], &a))                                      \
+            return JS_FALSE;                                                  \
+        *rval = INT_TO_JSVAL(*(type *) a);                                    \
+        return JS_TRUE;                                                       \
+    }
+
+#define DEFINE_POKE(name, type)                                               \
+    static JSBool                                                             \
+    name(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)  \
+    {                                                                         \
+        int a, v;                                                             \
+                                                                              \
+        if (!HEAP_ADDR(cx, argv[0], &a) || !HEAP_ADDR(cx, argv[1], &v))       \
+            return JS_FALSE;                                                  \
+        *(type *) a = (type) v;                                               \
+        return JS_TRUE;                                                       \
+    }
+
+DEFINE_PEEK(peek8u,  uint8_t)
+DEFINE_PEEK(peek8s,  int8_t)
+DEFINE_PEEK(peek16u, uint16_t)
+DEFINE_PEEK(peek16s, int16_t)
+DEFINE_POKE(poke8x,  uint8_t)
+DEFINE_POKE(poke16x, uint16_t)
+DEFINE_POKE(poke32x, uint32_t)
+
+static JSBool
+peek32u(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
+{
+    int a;
+    uint32_t v;
+
+    if (!HEAP_ADDR(cx, argv[0], &a))
+        return JS_FALSE;
+    v = *(uint32_t *) a;
+    if (v <= JSVAL_INT_MAX) {
+        *rval = INT_TO_JSVAL((jsint) v);
+        return JS_TRUE;
+    }
+    return JS_NewDoubleValue(cx, (jsdouble) v, rval);
+}
+
+static JSBool
+peek32s(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
+{
+    int a;
+
+    if (!HEAP_ADDR(cx, argv[0], &a))
+        return JS_FALSE;
+    return ffi_IntToValue(cx, *(int32_t *) a, rval);
+}
+
+/*
+ * ByteBuffer: a contiguous, malloc'd block of bytes with indexed access.
+ *
+ * Integer element gets and sets are caught in the object ops, ahead of the
+ * property lookup, so b[i] neither hashes an id nor grows the object's scope
+ * by a property per byte.  Everything else (length, methods, expandos) goes
+ * through js_ObjectOps as usual.
+ *
+ * A view made by subarray() shares the bytes of its root buffer at an
+ * offset and keeps the root alive through reserved slot 0.  Views have a
+ * fixed length; only a root buffer can push.  push may move the data, so a
+ * pointer() taken earlier must be fetched again after growing.
+ *
+ * A buffer may also be an mmap'd file (see mapFile below), in which case it
+ * has a fixed length and unmap() empties it along with all of its views.
+ */
+
+#define BB_OWNED        0x1     /* data is JS_malloc'd by us */
+#define BB_MAPPED       0x2     /* data is mmap'd by us */
+#define BB_READONLY     0x4     /* stores are errors */
+
+struct ByteBuffer {
+    uint8_t             *data;      /* root buffers only */
+    jsuint              length;
+    jsuint              capacity;
+    uintN               flags;
+    ByteBuffer          *root;      /* views only */
+    jsuint              offset;     /* views only, into root */
+};
+
+static uint8_t *
+ByteBufferData(ByteBuffer *bb)
+{
+    return bb->root ? bb->root->data + bb->offset : bb->data;
+}
+
+/* Views of a buffer that has been unmapped are empty. */
+static jsuint
+ByteBufferLength(ByteBuffer *bb)
+{
+    return (bb->root && !bb->root->data) ? 0 : bb->length;
+}
+
+extern JS_FRIEND_DATA(JSObjectOps) js_ObjectOps;
+
+static JSObjectOps bytebuffer_ops;
+
+static JSBool
+bytebuffer_getProperty(JSContext *cx, JSObject *obj, jsid id, jsval *vp)
+{
+    ByteBuffer *bb;
+    jsint i;
+
+    if (JSVAL_IS_INT((jsval) id)) {
+        bb = (ByteBuffer *) JS_GetPrivate(cx, obj);
+        i = JSVAL_TO_INT((jsval) id);
+        if (bb && i >= 0) {
+            *vp = ((jsuint) i < ByteBufferLength(bb))
+                  ? INT_TO_JSVAL(ByteBufferData(bb)[i])
+                  : JSVAL_VOID;
+            return JS_TRUE;
+        }
+    }
+    return js_ObjectOps.getProperty(cx, obj, id, vp);
+}
+
+static JSBool
+bytebuffer_setProperty(JSContext *cx, JSObject *obj, jsid id, jsval *vp)
+{
+    ByteBuffer *bb;
+    jsint i;
+    int v;
+
+    if (JSVAL_IS_INT((jsval) id)) {
+        bb = (ByteBuffer *) JS_GetPrivate(cx, obj);
+        i = JSVAL_TO_INT((jsval) id);
+        if (bb && i >= 0) {
+            if ((jsuint) i >= ByteBufferLength(bb)) {
+                JS_ReportError(cx, "ByteBuffer index %d out of range "
+                               "(length %u)", i, ByteBufferLength(bb));
+                return JS_FALSE;
+            }
+            if ((bb->root ? bb->root : bb)->flags & BB_READONLY) {
+                JS_ReportError(cx, "ByteBuffer is read-only");
+                return JS_FALSE;
+            }
+            if (JSVAL_IS_INT(*vp)) {
+                v = JSVAL_TO_INT(*vp);
+            } else if (!ffi_ValueToInt(cx, *vp, &v)) {
+                return JS_FALSE;
+            }
+            ByteBufferData(bb)[i] = (uint8_t) v;
+            return JS_TRUE;
+        }
+    }
+    return js_ObjectOps.setProperty(cx, obj, id, vp);
+}
+
+static void
+bytebuffer_initOps(void)
+{
+    bytebuffer_ops = js_ObjectOps;
+    bytebuffer_ops.getProperty = bytebuffer_getProperty;
+    bytebuffer_ops.setProperty = bytebuffer_setProperty;
+}
+
+static JSObjectOps *
+bytebuffer_getObjectOps(JSContext *cx, JSClass *clasp)
+{
+#ifndef _WIN32
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    /* Worker threads may make their first buffers at the same time. */
+    pthread_once(&once, bytebuffer_initOps);
+#else
+    if (!bytebuffer_ops.getProperty)
+        bytebuffer_initOps();
+#endif
+    return &bytebuffer_ops;
+}
+
+static void
+bytebuffer_finalize(JSContext *cx, JSObject *obj)
+{
+    ByteBuffer *bb;
+
+    bb = (ByteBuffer *) JS_GetPrivate(cx, obj);
+    if (!bb)
+        return;
+    if (bb->flags & BB_OWNED)
+        JS_free(cx, bb->data);
+#ifndef _WIN32
+    else if ((bb->flags & BB_MAPPED) && bb->data)
+        munmap(bb->data, bb->length);
+#endif
+    JS_free(cx, bb);
+}
+
+static JSClass bytebuffer_class = {
+    "ByteBuffer", JSCLASS_HAS_PRIVATE | JSCLASS_HAS_RESERVED_SLOTS(1),
+    JS_PropertyStub,  JS_PropertyStub,
+    JS_PropertyStub,  JS_PropertyStub,
+    JS_EnumerateStub, JS_ResolveStub,
+    JS_ConvertStub,   bytebuffer_finalize,
+    bytebuffer_getObjectOps
+};
+
+/*
+ * Make a ByteBuffer over data.  With BB_OWNED the buffer takes ownership of
+ * data, which must come from JS_malloc, and frees it when collected;
+ * otherwise data must outlive the buffer.  On failure an owned data block is
+ * left to the caller.
+ */
+static JSObject *
+NewByteBuffer(JSContext *cx, uint8_t *data, jsuint length, uintN flags)
+{
+    JSObject *obj;
+    ByteBuffer *bb;
+
+    bb = (ByteBuffer *) JS_malloc(cx, sizeof *bb);
+    if (!bb)
+        return NULL;
+    memset(bb, 0, sizeof *bb);
+    bb->data = data;
+    bb->length = bb->capacity = length;
+    obj = JS_NewObject(cx, &bytebuffer_class, NULL, NULL);
+    if (!obj || !JS_SetPrivate(cx, obj, bb)) {
+        JS_free(cx, bb);
+        return NULL;
+    }
+    bb->flags = flags;
+    return obj;
+}
+
+static ByteBuffer *
+GetByteBuffer(JSContext *cx, JSObject *obj, jsval *argv)
+{
+    return (ByteBuffer *)
+           JS_GetInstancePrivate(cx, obj, &bytebuffer_class, argv);
+}
+
+/*
+ * new ByteBuffer(length), ByteBuffer(array) or ByteBuffer(string): a zero
+ * filled buffer, or a copy of the low bytes of the elements or chars.
+ */
+static JSBool
+ByteBuffer_ctor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                jsval *rval)
+{
+    JSObject *bobj, *arr;
+    JSString *str;
+    const jschar *s;
+    uint8_t *data;
+    jsuint len, i;
+
+    arr = NULL;
+    str = NULL;
+    len = 0;
+    if (argc > 0 && JSVAL_IS_STRING(argv[0])) {
+        str = JSVAL_TO_STRING(argv[0]);
+        len = JS_GetStringLength(str);
+    } else if (argc > 0 && !JSVAL_IS_PRIMITIVE(argv[0])) {
+        arr = JSVAL_TO_OBJECT(argv[0]);
+        if (!JS_GetArrayLength(cx, arr, &len))
+            return JS_FALSE;
+    } else if (argc > 0 && !JS_ValueToECMAUint32(cx, argv[0], &len)) {
+        return JS_FALSE;
+    }
+
+    /* Allocate one byte so that an empty buffer still has an address. */
+    data = (uint8_t *) JS_malloc(cx, len ? len : 1);
+    if (!data)
+        return JS_FALSE;
+    if (str) {
+        s = JS_GetStringChars(str);
+        for (i = 0; i < len; i++)
+            data[i] = (uint8_t) s[i];
+    } else if (arr) {
+        if (!CopyArrayBytes(cx, arr, 0, len, data)) {
+            JS_free(cx, data);
+            return JS_FALSE;
+        }
+    } else {
+        memset(data, 0, len);
+    }
+
+    bobj = NewByteBuffer(cx, data, len, BB_OWNED);
+    if (!bobj) {
+        JS_free(cx, data);
+        return JS_FALSE;
+    }
+    *rval = OBJECT_TO_JSVAL(bobj);
+    return JS_TRUE;
+}
+
+/* push(byte, ...): append bytes, doubling the capacity as needed. */
+static JSBool
+ByteBuffer_push(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                jsval *rval)
+{
+    ByteBuffer *bb;
+    jsuint cap;
+    uint8_t *data;
+    uintN i;
+    int v;
+
+    bb = GetByteBuffer(cx, obj, argv);
+    if (!bb)
+        return JS_FALSE;
+    if (!(bb->flags & BB_OWNED)) {
+        JS_ReportError(cx, "can't push onto a fixed size ByteBuffer");
+        return JS_FALSE;
+    }
+    if (bb->length + argc > bb->capacity) {
+        cap = bb->capacity ? bb->capacity : 16;
+        while (cap < bb->length + argc)
+            cap *= 2;
+        data = (uint8_t *) JS_realloc(cx, bb->data, cap);
+        if (!data)
+            return JS_FALSE;
+        bb->data = data;
+        bb->capacity = cap;
+    }
+    for (i = 0; i < argc; i++) {
+        if (!ffi_ValueToInt(cx, argv[i], &v))
+            return JS_FALSE;
+        bb->data[bb->length++] = (uint8_t) v;
+    }
+    return ffi_IntToValue(cx, (int) bb->length, rval);
+}
+
+/* subarray(begin[, end]): a view sharing bytes begin .. end-1. */
+static JSBool
+ByteBuffer_subarray(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                    jsval *rval)
+{
+    ByteBuffer *bb, *view;
+    JSObject *vobj, *rootobj;
+    jsint len, begin, end;
+
+    bb = GetByteBuffer(cx, obj, argv);
+    if (!bb)
+        return JS_FALSE;
+    len = (jsint) ByteBufferLength(bb);
+    begin = 0;
+    end = len;
+    if (!JS_ConvertArguments(cx, argc, argv, "/ii", &begin, &end))
+        return JS_FALSE;
+    if (begin < 0)
+        begin += len;
+    if (end < 0)
+        end += len;
+    if (begin < 0)
+        begin = 0;
+    if (end > len)
+        end = len;
+    if (end < begin)
+        end = begin;
+
+    vobj = NewByteBuffer(cx, NULL, (jsuint) (end - begin), 0);
+    if (!vobj)
+        return JS_FALSE;
+    *rval = OBJECT_TO_JSVAL(vobj);
+    view = (ByteBuffer *) JS_GetPrivate(cx, vobj);
+    if (bb->root) {
+        view->root = bb->root;
+        view->offset = bb->offset + (jsuint) begin;
+        if (!JS_GetReservedSlot(cx, obj, 0, rval))
+            return JS_FALSE;
+        rootobj = JSVAL_TO_OBJECT(*rval);
+        *rval = OBJECT_TO_JSVAL(vobj);
+    } else {
+        view->root = bb;
+        view->offset = (jsuint) begin;
+        rootobj = obj;
+    }
+    return JS_SetReservedSlot(cx, vobj, 0, OBJECT_TO_JSVAL(rootobj));
+}
+
+/* pointer(): address of the first byte, for ffi_call and peek/poke. */
+static JSBool
+ByteBuffer_pointer(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                   jsval *rval)
+{
+    ByteBuffer *bb;
+
+    bb = GetByteBuffer(cx, obj, argv);
+    if (!bb)
+        return JS_FALSE;
+    return JS_NewNumberValue(cx, (jsdouble) (uint32) ByteBufferData(bb),
+                             rval);
+}
+
+static JSBool
+bytebuffer_getLength(JSContext *cx, JSObject *obj, jsval id, jsval *vp)
+{
+    ByteBuffer *bb;
+
+    bb = (ByteBuffer *) JS_GetInstancePrivate(cx, obj, &bytebuffer_class,
+                                              NULL);
+    return ffi_IntToValue(cx, bb ? (int) ByteBufferLength(bb) : 0, vp);
+}
+
+#ifndef _WIN32
+static ByteBuffer *
+GetMappedByteBuffer(JSContext *cx, JSObject *obj, jsval *argv)
+{
+    ByteBuffer *bb;
+
+    bb = GetByteBuffer(cx, obj, argv);
+    if (bb && (bb->root || !(bb->flags & BB_MAPPED))) {
+        JS_ReportError(cx, "ByteBuffer is not a mapped file");
+        return NULL;
+    }
+    return bb;
+}
+
+/* sync(): write a mapped file's dirty pages back with msync. */
+static JSBool
+ByteBuffer_sync(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                jsval *rval)
+{
+    ByteBuffer *bb;
+
+    bb = GetMappedByteBuffer(cx, obj, argv);
+    if (!bb)
+        return JS_FALSE;
+    if (bb->data && msync(bb->data, bb->length, MS_SYNC) != 0) {
+        JS_ReportError(cx, "can't sync mapped file: %s", strerror(errno));
+        return JS_FALSE;
+    }
+    return JS_TRUE;
+}
+
+/* unmap(): release a mapped file now rather than at GC time. */
+static JSBool
+ByteBuffer_unmap(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                 jsval *rval)
+{
+    ByteBuffer *bb;
+
+    bb = GetMappedByteBuffer(cx, obj, argv);
+    if (!bb)
+        return JS_FALSE;
+    if (bb->data) {
+        munmap(bb->data, bb->length);
+        bb->data = NULL;
+        bb->length = bb->capacity = 0;
+    }
+    return JS_TRUE;
+}
+#endif
+
+static JSPropertySpec bytebuffer_props[] = {
+    {"length",  0,  JSPROP_READONLY | JSPROP_PERMANENT | JSPROP_SHARED,
+                    bytebuffer_getLength, NULL},
+    {0}
+};
+
+static JSFunctionSpec bytebuffer_methods[] = {
+    {"push",            ByteBuffer_push,        1},
+    {"subarray",        ByteBuffer_subarray,    2},
+    {"pointer",         ByteBuffer_pointer,     0},
+#ifndef _WIN32
+    {"sync",            ByteBuffer_sync,        0},
+    {"unmap",           ByteBuffer_unmap,       0},
+#endif
+    {0}
+};
+
+static JSBool
+InitByteBufferClass(JSContext *cx, JSObject *obj)
+{
+    return JS_InitClass(cx, obj, NULL, &bytebuffer_class, ByteBuffer_ctor, 1,
+                        bytebuffer_props, bytebuffer_methods,
+                        NULL, NULL) != NULL;
+}
+
+/*
+ * readBytes(path[, offset[, length]]) reads a file, or length bytes of it
+ * from offset, straight into a new ByteBuffer: one byte per byte, with no
+ * string inflation to jschars and no per-byte JS work.
+ */
+static JSBool
+readBytes(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
+{
+    const char *path;
+    uint32 offset, length;
+    int fd, flags, cc;
+    struct stat sb;
+    uint8_t *data;
+    JSObject *bobj;
+    jsuint n;
+
+    offset = 0;
+    length = (uint32) -1;
+    if (!JS_ConvertArguments(cx, argc, argv, "s/uu", &path, &offset, &length))
+        return JS_FALSE;
+    flags = O_RDONLY;
+#ifdef O_BINARY
+    flags |= O_BINARY;
+#endif
+    fd = open(path, flags);
+    if (fd < 0) {
+        JS_ReportError(cx, "can't open %s: %s", path, strerror(errno));
+        return JS_FALSE;
+    }
+    if (fstat(fd, &sb) < 0) {
+        JS_ReportError(cx, "can't stat %s", path);
+        close(fd);
+        return JS_FALSE;
+    }
+    if (offset > (uint32) sb.st_size)
+        offset = (uint32) sb.st_size;
+    if (length > (uint32) sb.st_size - offset)
+        length = (uint32) sb.st_size - offset;
+    if (offset && lseek(fd, (off_t) offset, SEEK_SET) < 0) {
+        JS_ReportError(cx, "can't seek %s: %s", path, strerror(errno));
+        close(fd);
+        return JS_FALSE;
+    }
+
+    data = (uint8_t *) JS_malloc(cx, length ? length : 1);
+    if (!data) {
+        close(fd);
+        return JS_FALSE;
+    }
+    for (n = 0; n < length; n += cc) {
+        cc = read(fd, data + n, length - n);
+        if (cc <= 0) {
+            JS_ReportError(cx, "can't read %s: %s", path,
+                           (cc < 0) ? strerror(errno) : "short read");
+            JS_free(cx, data);
+            close(fd);
+            return JS_FALSE;
+        }
+    }
+    close(fd);
+
+    bobj = NewByteBuffer(cx, data, length, BB_OWNED);
+    if (!bobj) {
+        JS_free(cx, data);
+        return JS_FALSE;
+    }
+    *rval = OBJECT_TO_JSVAL(bobj);
+    return JS_TRUE;
+}
+
+/* Write all n bytes of p to fd, retrying short writes. */
+static JSBool
+WriteAll(JSContext *cx, const char *path, int fd, const uint8_t *p, size_t n)
+{
+    int cc;
+
+    while (n > 0) {
+        cc = write(fd, p, n);
+        if (cc < 0) {
+            if (errno == EINTR)
+                continue;
+            JS_ReportError(cx, "can't write %s: %s", path, strerror(errno));
+            return JS_FALSE;
+        }
+        p += cc;
+        n -= cc;
+    }
+    return JS_TRUE;
+}
+
+/*
+ * Write n bytes at p to path.  With atomic set, the data goes to a
+ * temporary of its own beside path (TempPathFor), which is then renamed
+ * over path, so readers never see a partial file.
+ */
+static JSBool
+WriteFileBytes(JSContext *cx, const char *path, const uint8_t *p, size_t n,
+               JSBool atomic)
+{
+    int fd, flags;
+    JSBool ok;
+#ifndef _WIN32
+    char *tmp;
+
+    if (atomic) {
+        tmp = TempPathFor(path);
+        if (!tmp) {
+            JS_ReportOutOfMemory(cx);
+            return JS_FALSE;
+        }
+        fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0) {
+            JS_ReportError(cx, "can't open %s: %s", tmp, strerror(errno));
+            JS_smprintf_free(tmp);
+            return JS_FALSE;
+        }
+        ok = WriteAll(cx, tmp, fd, p, n);
+        close(fd);
+        if (ok && rename(tmp, path) < 0) {
+            JS_ReportError(cx, "can't rename %s to %s: %s", tmp, path,
+                           strerror(errno));
+            ok = JS_FALSE;
+        }
+        if (!ok)
+            unlink(tmp);
+        JS_smprintf_free(tmp);
+        return ok;
+    }
+#endif
+
+    flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_BINARY
+    flags |= O_BINARY;
+#endif
+    fd = open(path, flags, 0666);
+    if (fd < 0) {
+        JS_ReportError(cx, "can't open %s: %s", path, strerror(errno));
+        return JS_FALSE;
+    }
+    ok = WriteAll(cx, path, fd, p, n);
+    close(fd);
+    return ok;
+}
+
+/*
+ * writeFile(path, source[, offset[, length[, atomic]]]) writes bytes to path
+ * with a single write.  source is a dense array of byte values, a ByteBuffer,
+ * or a heap address; for an address, length is required and offset is added
+ * to it.  With atomic true the file is replaced by rename.
+ */
+static JSBool
+writeFile(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
+{
+    const char *path;
+    jsval src;
+    uint32 offset, length, total;
+    JSBool atomic, ok;
+    JSObject *sobj;
+    ByteBuffer *bb;
+    uint8_t *p, *tmp;
+    int addr;
+
+    offset = 0;
+    length = (uint32) -1;
+    atomic = JS_FALSE;
+    if (!JS_ConvertArguments(cx, argc, argv, "sv/uub", &path, &src, &offset,
+                             &length, &atomic)) {
+        return JS_FALSE;
+    }
+
+    tmp = NULL;
+    if (JSVAL_IS_NUMBER(src)) {
+        if (argc < 4) {
+            JS_ReportError(cx, "writeFile: a heap address needs a length");
+            return JS_FALSE;
+        }
+        if (!ffi_ValueToInt(cx, src, &addr))
+            return JS_FALSE;
+        p = (uint8_t *) addr + offset;
+    } else if (!JSVAL_IS_PRIMITIVE(src)) {
+        sobj = JSVAL_TO_OBJECT(src);
+        if (JS_GET_CLASS(cx, sobj) == &bytebuffer_class) {
+            bb = (ByteBuffer *) JS_GetPrivate(cx, sobj);
+            total = bb ? ByteBufferLength(bb) : 0;
+            if (offset > total)
+                offset = total;
+            if (length > total - offset)
+                length = total - offset;
+            p = bb ? ByteBufferData(bb) + offset : NULL;
+        } else {
+            if (!JS_GetArrayLength(cx, sobj, &total))
+                return JS_FALSE;
+            if (offset > total)
+                offset = total;
+            if (length > total - offset)
+                length = total - offset;
+            tmp = (uint8_t *) JS_malloc(cx, length ? length : 1);
+            if (!tmp)
+                return JS_FALSE;
+            if (!CopyArrayBytes(cx, sobj, offset, length, tmp)) {
+                JS_free(cx, tmp);
+                return JS_FALSE;
+            }
+            p = tmp;
+        }
+    } else {
+        JS_ReportError(cx, "writeFile: source must be an array, a ByteBuffer "
+                       "or a heap address");
+        return JS_FALSE;
+    }
+
+    ok = WriteFileBytes(cx, path, p, length, atomic);
+    if (tmp)
+        JS_free(cx, tmp);
+    return ok;
+}
+
+#ifndef _WIN32
+/*
+ * Mapped files.
+ *
+ * mapFile(path[, mode]) maps an existing file as a fixed size ByteBuffer:
+ * mode "r" (the default) is read-only, "rw" writes through to the file and
+ * "c" is a private copy-on-write mapping.  mapOutputFile(path, size) creates
+ * or truncates path to size bytes and maps it "rw", so an output image can
+ * be built in place in the page cache.  Use sync() to flush and unmap() to
+ * release the mapping early; otherwise it goes when the buffer is collected.
+ */
+static JSBool
+MapFileToBuffer(JSContext *cx, const char *path, int fd, jsuint size,
+                int prot, int flags, uintN bbflags, jsval *rval)
+{
+    JSObject *bobj;
+    uint8_t *data;
+    void *p;
+
+    if (size == 0) {
+        /* mmap can't map nothing; an empty buffer still needs an address. */
+        close(fd);
+        data = (uint8_t *) JS_malloc(cx, 1);
+        if (!data)
+            return JS_FALSE;
+        bobj = NewByteBuffer(cx, data, 0, BB_OWNED | bbflags);
+        if (!bobj) {
+            JS_free(cx, data);
+            return JS_FALSE;
+        }
+        *rval = OBJECT_TO_JSVAL(bobj);
+        return JS_TRUE;
+    }
+
+    p = mmap(NULL, size, prot, flags, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        JS_ReportError(cx, "can't map %s: %s", path, strerror(errno));
+        return JS_FALSE;
+    }
+    bobj = NewByteBuffer(cx, (uint8_t *) p, size, BB_MAPPED | bbflags);
+    if (!bobj) {
+        munmap(p, size);
+        return JS_FALSE;
+    }
+    *rval = OBJECT_TO_JSVAL(bobj);
+    return JS_TRUE;
+}
+
+static JSBool
+mapFile(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
+{
+    const char *path, *mode;
+    int fd, oflags, prot, flags;
+    uintN bbflags;
+    struct stat sb;
+
+    mode = "r";
+    if (!JS_ConvertArguments(cx, argc, argv, "s/s", &path, &mode))
+        return JS_FALSE;
+    if (!strcmp(mode, "r")) {
+        oflags = O_RDONLY;
+        prot = PROT_READ;
+        flags = MAP_SHARED;
+        bbflags = BB_READONLY;
+    } else if (!strcmp(mode, "rw")) {
+        oflags = O_RDWR;
+        prot = PROT_READ | PROT_WRITE;
+        flags = MAP_SHARED;
+        bbflags = 0;
+    } else if (!strcmp(mode, "c")) {
+        oflags = O_RDONLY;
+        prot = PROT_READ | PROT_WRITE;
+        flags = MAP_PRIVATE;
+        bbflags = 0;
+    } else {
+        JS_ReportError(cx, "mapFile: bad mode \"%s\"", mode);
+        return JS_FALSE;
+    }
+
+    fd = open(path, oflags);
+    if (fd < 0) {
+        JS_ReportError(cx, "can't open %s: %s", path, strerror(errno));
+        return JS_FALSE;
+    }
+    if (fstat(fd, &sb) < 0) {
+        JS_ReportError(cx, "can't stat %s", path);
+        close(fd);
+        return JS_FALSE;
+    }
+    return MapFileToBuffer(cx, path, fd, (jsuint) sb.st_size, prot, flags,
+                           bbflags, rval);
+}
+
+static JSBool
+mapOutputFile(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+              jsval *rval)
+{
+    const char *path;
+    uint32 size;
+    int fd;
+
+    if (!JS_ConvertArguments(cx, argc, argv, "su", &path, &size))
+        return JS_FALSE;
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        JS_ReportError(cx, "can't open %s: %s", path, strerror(errno));
+        return JS_FALSE;
+    }
+    if (ftruncate(fd, (off_t) size) < 0) {
+        JS_ReportError(cx, "can't size %s: %s", path, strerror(errno));
+        close(fd);
+        return JS_FALSE;
+    }
+    return MapFileToBuffer(cx, path, fd, size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, 0, rval);
+}
+#endif
+
+/*
+ * Heap regions.
+ *
+ * heap_region(size[, reserve[, hugepages]]) returns an object whose
+ * ri8/wi8/ri32/wi32 members are native accessors taking offsets into a
+ * zeroed block of size bytes, for scripts to install directly as globals.
+ * Each accessor carries the region in its private data and keeps the region
+ * object alive through reserved slot 0, so a call is a bounds check and a
+ * load or store with no closure and no address arithmetic in JS.  An out of
+ * range offset is a JS error rather than a stray write.
+ *
+ * With a reserve larger than size the region can grow in place up to
+ * reserve bytes.  On Unix the whole reserve is mapped PROT_NONE and
+ * MAP_NORESERVE up front and pages are committed as the region grows, so
+ * base never moves and untouched memory costs no RSS; hugepages asks for
+ * transparent huge pages on the range.  Accessors grow the region on demand
+ * when they reach past size but stay inside the reserve, and grow()/shrink()
+ * resize it explicitly.  Elsewhere the block is calloc'd and can't grow.
+ */
+#define HR_MMAP         0x1     /* base is an mmap'd reservation */
+#define HR_RESTORED     0x2     /* part of it maps a heapRestore snapshot */
+
+typedef struct HeapRegion {
+    struct HeapRegion *next;    /* in gHeapRegions */
+    uint8_t     *base;
+    uint32      size;           /* bytes accessible to scripts */
+    uint32      committed;      /* bytes currently readable and writable */
+    uint32      reserved;       /* largest size the region may grow to */
+    uintN       flags;
+} HeapRegion;
+
+/*
+ * Bytes reserved by all live regions, finalized or not yet.  Worker threads
+ * (js_worker.c) make and finalize regions too, so the list and the total
+ * are only touched under gHeapRegionLock.
+ */
+static uint32 gHeapRegionReserved = 0;
+static HeapRegion *gHeapRegions = NULL;
+
+#ifndef _WIN32
+static pthread_mutex_t gHeapRegionLock = PTHREAD_MUTEX_INITIALIZER;
+#define HeapRegionLock()        pthread_mutex_lock(&gHeapRegionLock)
+#define HeapRegionUnlock()      pthread_mutex_unlock(&gHeapRegionLock)
+#else
+#define HeapRegionLock()        ((void) 0)
+#define HeapRegionUnlock()      ((void) 0)
+#endif
+
+#ifndef _WIN32
+static uint32
+heap_page_round(uint32 n)
+{
+    uint32 page = (uint32) sysconf(_SC_PAGESIZE);
+
+    return (n + page - 1) & ~(page - 1);
+}
+#endif
+
+/* Set up hr->base for size bytes, reserving room to grow to reserve. */
+static JSBool
+HeapRegionAllocate(HeapRegion *hr, uint32 size, uint32 reserve,
+                   JSBool hugepages)
+{
+    memset(hr, 0, sizeof *hr);
+#ifndef _WIN32
+    if (reserve > size) {
+        void *p;
+
+        reserve = heap_page_round(reserve);
+        p = mmap(NULL, reserve, PROT_NONE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED)
+            return JS_FALSE;
+#ifdef MADV_HUGEPAGE
+        if (hugepages)
+            madvise(p, reserve, MADV_HUGEPAGE);
+#endif
+        hr->base = (uint8_t *) p;
+        hr->reserved = reserve;
+        hr->flags = HR_MMAP;
+        hr->committed = heap_page_round(size);
+        if (hr->committed &&
+            mprotect(p, hr->committed, PROT_READ | PROT_WRITE) != 0) {
+            munmap(p, reserve);
+            return JS_FALSE;
+        }
+        hr->size = size;
+        HeapRegionLock();
+        gHeapRegionReserved += reserve;
+        hr->next = gHeapRegions;
+        gHeapRegions = hr;
+        HeapRegionUnlock();
+        return JS_TRUE;
+    }
+#endif
+    hr->base = (uint8_t *) calloc(size ? size : 1, 1);
+    if (!hr->base)
+        return JS_FALSE;
+    hr->size = hr->committed = hr->reserved = size;
+    HeapRegionLock();
+    gHeapRegionReserved += size;
+    hr->next = gHeapRegions;
+    gHeapRegions = hr;
+    HeapRegionUnlock();
+    return JS_TRUE;
+}
+
+static void
+HeapRegionRelease(HeapRegion *hr)
+{
+    HeapRegion **hrp;
+
+    HeapRegionLock();
+    for (hrp = &gHeapRegions; *hrp; hrp = &(*hrp)->next) {
+        if (*hrp == hr) {
+            *hrp = hr->next;
+            break;
+        }
+    }
+    gHeapRegionReserved -= hr->reserved;
+    HeapRegionUnlock();
+#ifndef _WIN32
+    if (hr->flags & HR_MMAP) {
+        munmap(hr->base, hr->reserved);
+        return;
+    }
+#endif
+    free(hr->base);
+}
+
+/*
+ * Make size bytes accessible, committing or decommitting whole pages.  Bytes
+ * dropped by a shrink read back as zero if the region grows again.
+ */
+static JSBool
+HeapRegionResize(JSContext *cx, HeapRegion *hr, uint32 size)
+{
+    if (size > hr->reserved) {
+        JS_ReportError(cx, "heap region can't grow to %u bytes (reserved %u)",
+                       size, hr->reserved);
+        return JS_FALSE;
+    }
+#ifndef _WIN32
+    if (hr->flags & HR_MMAP) {
+        uint32 committed = heap_page_round(size);
+
+        if (committed > hr->committed) {
+            if (mprotect(hr->base + hr->committed, committed - hr->committed,
+                         PROT_READ | PROT_WRITE) != 0) {
+                JS_ReportError(cx, "can't commit heap region: %s",
+                               strerror(errno));
+                return JS_FALSE;
+            }
+        } else if (committed < hr->committed && (hr->flags & HR_RESTORED)) {
+            /* Dropped pages of a snapshot would read back from the file. */
+            mmap(hr->base + committed, hr->committed - committed, PROT_NONE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+                 -1, 0);
+        } else if (committed < hr->committed) {
+            madvise(hr->base + committed, hr->committed - committed,
+                    MADV_DONTNEED);
+            mprotect(hr->base + committed, hr->committed - committed,
+                     PROT_NONE);
+        }
+        if (size < hr->size)
+            memset(hr->base + size, 0, committed - size);
+        hr->committed = committed;
+        hr->size = size;
+        return JS_TRUE;
+    }
+#endif
+    if (size < hr->size)
+        memset(hr->base + size, 0, hr->size - size);
+    hr->size = size;
+    return JS_TRUE;
+}
+
+static void
+heap_region_finalize(JSContext *cx, JSObject *obj)
+{
+    HeapRegion *hr;
+
+    hr = (HeapRegion *) JS_GetPrivate(cx, obj);
+    if (!hr)
+        return;
+    HeapRegionRelease(hr);
+    JS_free(cx, hr);
+}
+
+static JSClass heap_region_class = {
+    "HeapRegion", JSCLASS_HAS_PRIVATE,
+    JS_PropertyStub,  JS_PropertyStub,
+    JS_PropertyStub,  JS_PropertyStub,
+    JS_EnumerateStub, JS_ResolveStub,
+    JS_ConvertStub,   heap_region_finalize
+};
+
+/*
+ * Check that width bytes at offset v are inside hr, growing the region (at
+ * least doubling it) when they fall inside the reserve.
+ */
+static JSBool
+heap_region_check(JSContext *cx, const char *name, HeapRegion *hr, jsval v,
+                  uint32 width, int *op)
+{
+    uint32 end, size;
+
+    if (!HEAP_ADDR(cx, v, op))
+        return JS_FALSE;
+    if (hr->size >= width && (uint32) *op <= hr->size - width)
+        return JS_TRUE;
+
+    end = (uint32) *op + width;
+    if (*op >= 0 && end >= width && end <= hr->reserved) {
+        size = (hr->size > hr->reserved / 2) ? hr->reserved : hr->size * 2;
+        return HeapRegionResize(cx, hr, (size > end) ? size : end);
+    }
+    JS_ReportError(cx, "%s: offset %d out of range (region size %u)",
+                   name, *op, hr->size);
+    return JS_FALSE;
+}
+
+#define REGION_OF(cx, argv)                                                   \
+    ((HeapRegion *) JS_GetPrivate(cx, JSVAL_TO_OBJECT((argv)[-2])))
+
+static JSBool
+region_ri8(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
+{
+    HeapRegion *hr = REGION_OF(cx, argv);
+    int o;
+
+    if (!heap_region_check(cx, "ri8", hr, argc ? argv[0] : JSVAL_VOID, 1, &o))
+        return JS_FALSE;
+    *rval = INT_TO_JSVAL(hr->base[o]);
+    return JS_TRUE;
+}
+
+static JSBool
+region_ri32(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
+{
+    HeapRegion *hr = REGION_OF(cx, argv);
+    int o;
+
+    if (!heap_region_check(cx, "ri32", hr, argc ? argv[0] : JSVAL_VOID, 4, &o))
+        return JS_FALSE;
+    return ffi_IntToValue(cx, *(int32_t *) (hr->base + o), rval);
+}
+
+/*
+ * A missing or undefined value stores 0, for wi32 as for wi8.  That is
+ * what a store of undefined into an Int32Array does, which is what the
+ * stage scripts were written against; m0 has been seen to do it.
+ */
+static JSBool
+region_store(JSContext *cx, const char *name, uintN argc, jsval *argv,
+             uint32 width)
+{
+    HeapRegion *hr = REGION_OF(cx, argv);
+    int o, v;
+
+    if (!heap_region_check(cx, name, hr, argc ? argv[0] : JSVAL_VOID, width,
+                           &o)) {
+        return JS_FALSE;
+    }
+    if (argc < 2 || JSVAL_IS_VOID(argv[1])) {
+        v = 0;
+    } else if (!HEAP_ADDR(cx, argv[1], &v)) {
+        return JS_FALSE;
+    }
+    if (width == 1)
+        hr->base[o] = (uint8_t) v;
+    else
+        *(int32_t *) (hr->base + o) = v;
+    return JS_TRUE;
+}
+
+static JSBool
+region_wi8(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
+{
+    return region_store(cx, "wi8", argc, argv, 1);
+}
+
+static JSBool
+region_wi32(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
+{
+    return region_store(cx, "wi32", argc, argv, 4);
+}
+
+#define HEAP_ACCESSOR_CLASS(name, call)                                       \
+    {                                                                         \
+        name, JSCLASS_HAS_PRIVATE | JSCLASS_HAS_RESERVED_SLOTS(1),            \
+        JS_PropertyStub,  JS_PropertyStub,                                    \
+        JS_PropertyStub,  JS_PropertyStub,                                    \
+        JS_EnumerateStub, JS_ResolveStub,                                     \
+        JS_ConvertStub,   JS_FinalizeStub,                                    \
+        NULL,             NULL,                                               \
+        call                                                                  \
+    }
+
+static JSClass heap_accessor_classes[] = {
+    HEAP_ACCESSOR_CLASS("ri8",  region_ri8),
+    HEAP_ACCESSOR_CLASS("wi8",  region_wi8),
+    HEAP_ACCESSOR_CLASS("ri32", region_ri32),
+    HEAP_ACCESSOR_CLASS("wi32", region_wi32)
+};
+
+#define NUM_HEAP_ACCESSORS \
+    (sizeof heap_accessor_classes / sizeof heap_accessor_classes[0])
+
+/* grow(size) and shrink(size): resize the region, returning the new size. */
+static JSBool
+HeapRegion_resize(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                  jsval *rval, JSBool grow)
+{
+    HeapRegion *hr;
+    uint32 size;
+
+    hr = (HeapRegion *) JS_GetInstancePrivate(cx, obj, &heap_region_class,
+                                              argv);
+    if (!hr || !JS_ConvertArguments(cx, argc, argv, "u", &size))
+        return JS_FALSE;
+    if (grow ? size > hr->size : size < hr->size) {
+        if (!HeapRegionResize(cx, hr, size))
+            return JS_FALSE;
+    }
+    return JS_NewNumberValue(cx, (jsdouble) hr->size, rval);
+}
+
+static JSBool
+HeapRegion_grow(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                jsval *rval)
+{
+    return HeapRegion_resize(cx, obj, argc, argv, rval, JS_TRUE);
+}
+
+static JSBool
+HeapRegion_shrink(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                  jsval *rval)
+{
+    return HeapRegion_resize(cx, obj, argc, argv, rval, JS_FALSE);
+}
+
+enum heap_region_tinyid {
+    HEAP_REGION_SIZE, HEAP_REGION_COMMITTED, HEAP_REGION_RESERVED
+};
+
+static JSBool
+heap_region_getProperty(JSContext *cx, JSObject *obj, jsval id, jsval *vp)
+{
+    HeapRegion *hr;
+
+    hr = (HeapRegion *) JS_GetInstancePrivate(cx, obj, &heap_region_class,
+                                              NULL);
+    if (!hr || !JSVAL_IS_INT(id))
+        return JS_TRUE;
+    switch (JSVAL_TO_INT(id)) {
+      case HEAP_REGION_SIZE:
+        return JS_NewNumberValue(cx, (jsdouble) hr->size, vp);
+      case HEAP_REGION_COMMITTED:
+        return JS_NewNumberValue(cx, (jsdouble) hr->committed, vp);
+      case HEAP_REGION_RESERVED:
+        return JS_NewNumberValue(cx, (jsdouble) hr->reserved, vp);
+    }
+    return JS_TRUE;
+}
+
+#define HEAP_REGION_PROP_FLAGS \
+    (JSPROP_ENUMERATE | JSPROP_READONLY | JSPROP_PERMANENT | JSPROP_SHARED)
+
+static JSPropertySpec heap_region_props[] = {
+    {"size",      HEAP_REGION_SIZE,      HEAP_REGION_PROP_FLAGS,
+                  heap_region_getProperty, NULL},
+    {"committed", HEAP_REGION_COMMITTED, HEAP_REGION_PROP_FLAGS,
+                  heap_region_getProperty, NULL},
+    {"reserved",  HEAP_REGION_RESERVED,  HEAP_REGION_PROP_FLAGS,
+                  heap_region_getProperty, NULL},
+    {0}
+};
+
+static JSFunctionSpec heap_region_methods[] = {
+    {"grow",            HeapRegion_grow,        1},
+    {"shrink",          HeapRegion_shrink,      1},
+    {0}
+};
+
+/*
+ * Wrap hr, which must have come from JS_malloc and HeapRegionAllocate, in a
+ * HeapRegion object with its accessors, methods and properties.  The object
+ * owns hr from then on, even on failure.
+ */
+static JSObject *
+NewHeapRegion(JSContext *cx, HeapRegion *hr)
+{
+    JSObject *robj, *aobj;
+    jsval v;
+    uintN i;
+
+    robj = JS_NewObject(cx, &heap_region_class, NULL, NULL);
+    if (!robj || !JS_SetPrivate(cx, robj, hr)) {
+        HeapRegionRelease(hr);
+        JS_free(cx, hr);
+        return NULL;
+    }
+
+    /* robj is unrooted until the caller stores it, so root it meanwhile. */
+    if (!JS_AddNamedRoot(cx, &robj, "heap region"))
+        return NULL;
+    for (i = 0; i < NUM_HEAP_ACCESSORS; i++) {
+        aobj = JS_NewObject(cx, &heap_accessor_classes[i], NULL, NULL);
+        if (!aobj ||
+            !JS_SetPrivate(cx, aobj, hr) ||
+            !JS_SetReservedSlot(cx, aobj, 0, OBJECT_TO_JSVAL(robj)) ||
+            !JS_DefineProperty(cx, robj, heap_accessor_classes[i].name,
+                               OBJECT_TO_JSVAL(aobj), NULL, NULL,
+                               JSPROP_ENUMERATE | JSPROP_READONLY)) {
+            goto bad;
+        }
+    }
+    if (!JS_NewNumberValue(cx, (jsdouble) (uint32) hr->base, &v) ||
+        !JS_DefineProperty(cx, robj, "base", v, NULL, NULL,
+                           JSPROP_ENUMERATE | JSPROP_READONLY) ||
+        !JS_DefineProperties(cx, robj, heap_region_props) ||
+        !JS_DefineFunctions(cx, robj, heap_region_methods)) {
+        goto bad;
+    }
+    JS_RemoveRoot(cx, &robj);
+    return robj;
+
+  bad:
+    JS_RemoveRoot(cx, &robj);
+    return NULL;
+}
+
+static JSBool
+heap_region(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
+{
+    uint32 size, reserve;
+    JSBool hugepages;
+    HeapRegion *hr;
+    JSObject *robj;
+
+    reserve = 0;
+    hugepages = JS_FALSE;
+    if (!JS_ConvertArguments(cx, argc, argv, "u/ub", &size, &reserve,
+                             &hugepages)) {
+        return JS_FALSE;
+    }
+    hr = (HeapRegion *) JS_malloc(cx, sizeof *hr);
+    if (!hr)
+        return JS_FALSE;
+    if (!HeapRegionAllocate(hr, size, reserve, hugepages)) {
+        JS_free(cx, hr);
+        JS_ReportOutOfMemory(cx);
+        return JS_FALSE;
+    }
+    robj = NewHeapRegion(cx, hr);
+    if (!robj)
+        return JS_FALSE;
+    *rval = OBJECT_TO_JSVAL(robj);
+    return JS_TRUE;
+}
+
+#ifndef _WIN32
+/*
+ * Heap snapshots.
+ *
+ * heapSnapshot(path, ptr, len[, layout]) saves len bytes at ptr, which must
+ * lie inside a heap region, to path, behind a header page recording where
+ * they came from, a checksum and layout: a number of the caller's choosing
+ * that names the layout of the tables saved, 0 if not given.
+ * heapRestore(path[, ptr[, layout]]) puts them back at ptr, by default the
+ * address they were taken from, and returns their length; given a layout,
+ * it refuses a snapshot saved with another.  The destination must lie
+ * inside a heap region, which grows to cover it if need be.  The
+ * checksum is verified on a read-only mapping of the file before anything
+ * at ptr changes, so a damaged snapshot leaves the region as it was.  When
+ * ptr is page aligned in a reserved region the snapshot's whole pages are
+ * then mapped there copy-on-write with mmap(MAP_PRIVATE), so they copy
+ * nothing and stay shared with the page cache until written; a partial last
+ * page, and everything elsewhere, is copied, so bytes past the end of the
+ * snapshot are left alone.  A region's base moves from run to run, so
+ * tables meant for restoring should hold region offsets, as ri8/wi8 do,
+ * rather than addresses.
+ */
+#define HEAP_SNAPSHOT_MAGIC     0x5348534a      /* "JSHS" */
+#define HEAP_SNAPSHOT_VERSION   2               /* of this header */
+
+typedef struct HeapSnapshotHeader {
+    uint32      magic;
+    uint32      version;
+    uint32      layout;         /* the caller's tag for what the bytes hold */
+    uint32      address;        /* where the bytes were taken from */
+    uint32      length;
+    uint32      offset;         /* of the bytes in the file, page aligned */
+    uint32      checksum;
+} HeapSnapshotHeader;
+
+/* FNV-1a a word at a time, which is plenty for catching a damaged file. */
+static uint32
+HeapChecksum(const uint8_t *p, uint32 n)
+{
+    uint32 h, w;
+
+    h = 2166136261U;
+    for (; n >= 4; p += 4, n -= 4) {
+        memcpy(&w, p, 4);
+        h = (h ^ w) * 16777619U;
+    }
+    while (n-- > 0)
+        h = (h ^ *p++) * 16777619U;
+    return h;
+}
+
+/* Whether length bytes at p lie inside the accessible part of a region. */
+static JSBool
+HeapRegionHolds(uint8_t *p, uint32 length)
+{
+    HeapRegion *hr;
+    JSBool holds;
+
+    holds = JS_FALSE;
+    HeapRegionLock();
+    for (hr = gHeapRegions; hr; hr = hr->next) {
+        if (p >= hr->base && (uint32) (p - hr->base) <= hr->size &&
+            length <= hr->size - (uint32) (p - hr->base)) {
+            holds = JS_TRUE;
+            break;
+        }
+    }
+    HeapRegionUnlock();
+    return holds;
+}
+
+static JSBool
+heapSnapshot(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+             jsval *rval)
+{
+    const char *path;
+    int addr;
+    uint32 length, layout;
+    HeapSnapshotHeader *hdr;
+    uint8_t *page;
+    char *tmp;
+    int fd;
+    JSBool ok;
+
+    if (argc < 3 || !JS_ConvertArguments(cx, 1, argv, "s", &path) ||
+        !HEAP_ADDR(cx, argv[1], &addr) ||
+        !JS_ValueToECMAUint32(cx, argv[2], &length)) {
+        return JS_FALSE;
+    }
+    layout = 0;
+    if (argc > 3 && !JS_ValueToECMAUint32(cx, argv[3], &layout))
+        return JS_FALSE;
+    if (!HeapRegionHolds((uint8_t *) addr, length)) {
+        JS_ReportError(cx, "heapSnapshot: %u bytes at 0x%x are not inside a "
+                       "heap region", length, (uint32) addr);
+        return JS_FALSE;
+    }
+
+    page = (uint8_t *) JS_malloc(cx, (uint32) sysconf(_SC_PAGESIZE));
+    if (!page)
+        return JS_FALSE;
+    memset(page, 0, (uint32) sysconf(_SC_PAGESIZE));
+    hdr = (HeapSnapshotHeader *) page;
+    hdr->magic = HEAP_SNAPSHOT_MAGIC;
+    hdr->version = HEAP_SNAPSHOT_VERSION;
+    hdr->layout = layout;
+    hdr->address = (uint32) addr;
+    hdr->length = length;
+    hdr->offset = (uint32) sysconf(_SC_PAGESIZE);
+    hdr->checksum = HeapChecksum((const uint8_t *) addr, length);
+
+    /* Like writeFile's atomic mode, so a reader never sees half of one. */
+    tmp = TempPathFor(path);
+    if (!tmp) {
+        JS_free(cx, page);
+        JS_ReportOutOfMemory(cx);
+        return JS_FALSE;
+    }
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        JS_ReportError(cx, "can't create %s: %s", tmp, strerror(errno));
+        ok = JS_FALSE;
+    } else {
+        ok = WriteAll(cx, tmp, fd, page, hdr->offset) &&
+             WriteAll(cx, tmp, fd, (const uint8_t *) addr, length);
+        if (close(fd) < 0 && ok) {
+            JS_ReportError(cx, "can't write %s: %s", tmp, strerror(errno));
+            ok = JS_FALSE;
+        }
+        if (ok && rename(tmp, path) < 0) {
+            JS_ReportError(cx, "can't rename %s to %s: %s", tmp, path,
+                           strerror(errno));
+            ok = JS_FALSE;
+        }
+        if (!ok)
+            unlink(tmp);
+    }
+    JS_smprintf_free(tmp);
+    JS_free(cx, page);
+    return ok;
+}
+
+/* The region holding length bytes at p, growing it to cover them. */
+static HeapRegion *
+HeapRegionCovering(JSContext *cx, uint8_t *p, uint32 length)
+{
+    HeapRegion *hr;
+    uint32 end;
+
+    HeapRegionLock();
+    for (hr = gHeapRegions; hr; hr = hr->next) {
+        if (p >= hr->base && length <= hr->reserved &&
+            (uint32) (p - hr->base) <= hr->reserved - length) {
+            break;
+        }
+    }
+    HeapRegionUnlock();
+    if (!hr) {
+        JS_ReportError(cx, "heapRestore: %u bytes at 0x%x are not inside a "
+                       "heap region", length, (uint32) p);
+        return NULL;
+    }
+    end = (uint32) (p - hr->base) + length;
+    if (end > hr->size && !HeapRegionResize(cx, hr, end))
+        return NULL;
+    return hr;
+}
+
+static JSBool
+heapRestore(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+            jsval *rval)
+{
+    const char *path;
+    HeapSnapshotHeader hdr;
+    HeapRegion *hr;
+    struct stat sb;
+    uint8_t *p, *src;
+    uint32 page, whole, layout;
+    int fd, addr;
+    void *m;
+    JSBool ok;
+
+    if (!JS_ConvertArguments(cx, argc, argv, "s", &path))
+        return JS_FALSE;
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        JS_ReportError(cx, "can't open %s: %s", path, strerror(errno));
+        return JS_FALSE;
+    }
+    if (read(fd, &hdr, sizeof hdr) != sizeof hdr ||
+        hdr.magic != HEAP_SNAPSHOT_MAGIC ||
+        hdr.version != HEAP_SNAPSHOT_VERSION) {
+        JS_ReportError(cx, "%s is not a heap snapshot from this shell", path);
+        close(fd);
+        return JS_FALSE;
+    }
+    if (fstat(fd, &sb) < 0 ||
+        (uint32) sb.st_size < hdr.offset ||
+        (uint32) sb.st_size - hdr.offset < hdr.length) {
+        JS_ReportError(cx, "heap snapshot %s is truncated", path);
+        close(fd);
+        return JS_FALSE;
+    }
+    addr = (int) hdr.address;
+    if (argc > 1 && !JSVAL_IS_VOID(argv[1]) && !HEAP_ADDR(cx, argv[1], &addr)) {
+        close(fd);
+        return JS_FALSE;
+    }
+    if (argc > 2 && !JSVAL_IS_VOID(argv[2])) {
+        if (!JS_ValueToECMAUint32(cx, argv[2], &layout)) {
+            close(fd);
+            return JS_FALSE;
+        }
+        if (layout != hdr.layout) {
+            JS_ReportError(cx, "heap snapshot %s has layout %u, not %u",
+                           path, hdr.layout, layout);
+            close(fd);
+            return JS_FALSE;
+        }
+    }
+    p = (uint8_t *) addr;
+    if (hdr.length == 0) {
+        close(fd);
+        return HeapRegionCovering(cx, p, 0) != NULL &&
+               JS_NewNumberValue(cx, 0, rval);
+    }
+
+    /* Check the bytes before they go anywhere near p. */
+    m = mmap(NULL, hdr.offset + hdr.length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED) {
+        JS_ReportError(cx, "can't map %s: %s", path, strerror(errno));
+        close(fd);
+        return JS_FALSE;
+    }
+    src = (uint8_t *) m + hdr.offset;
+    ok = JS_FALSE;
+    if (HeapChecksum(src, hdr.length) != hdr.checksum) {
+        JS_ReportError(cx, "heap snapshot %s is damaged", path);
+        goto out;
+    }
+    hr = HeapRegionCovering(cx, p, hdr.length);
+    if (!hr)
+        goto out;
+
+    page = (uint32) sysconf(_SC_PAGESIZE);
+    whole = 0;
+    if ((hr->flags & HR_MMAP) &&
+        ((uint32) p & (page - 1)) == 0 && (hdr.offset & (page - 1)) == 0) {
+        whole = hdr.length & ~(page - 1);
+    }
+    if (whole != 0) {
+        if (mmap(p, whole, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                 fd, (off_t) hdr.offset) == MAP_FAILED) {
+            JS_ReportError(cx, "can't map %s: %s", path, strerror(errno));
+            goto out;
+        }
+        hr->flags |= HR_RESTORED;
+    }
+    memcpy(p + whole, src + whole, hdr.length - whole);
+    ok = JS_NewNumberValue(cx, (jsdouble) hdr.length, rval);
+
+  out:
+    munmap(m, hdr.offset + hdr.length);
+    close(fd);
+    return ok;
+}
+#endif
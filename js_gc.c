@@ -0,0 +1,487 @@
+/*
+ * GC heap limits and collection policy shared by js.c and js_min.c.
+ *
+ * modifications (C) Liam Wilson 2025 under the same license as js.c
+ *
+ * The shell's runtime used to get a fixed 64 MB GC heap, and collections
+ * came only from the engine running out of it and from JS_MaybeGC's fixed
+ * rule of half again what the last GC left.  These settings replace that.
+ * Each one is read from the environment first and from the command line,
+ * which wins:
+ *
+ *   --gc-max-bytes N     JS_GC_MAX_BYTES   GC heap limit, with an optional
+ *                                          K, M or G suffix (default 64M)
+ *   --gc-trigger RATIO   JS_GC_TRIGGER     collect once the heap is RATIO
+ *                                          times what the last GC left
+ *                                          (default 1.5)
+ *   --gc-interval MS     JS_GC_INTERVAL    leave at least MS milliseconds
+ *                                          between collections unless the
+ *                                          heap is nearly full (default 0)
+ *   --gc-policy P        JS_GC_POLICY      "fixed" (default) or "adaptive"
+ *
+ * The branch callback looks at the heap.  Under the fixed policy it does so
+ * every 16K backward branches, applying the trigger ratio the way
+ * JS_MaybeGC applies its own.  The adaptive policy also tracks how much the
+ * heap grows between looks.  It looks more often while allocation is fast
+ * and less often while the heap holds still.  It collects early when the
+ * heap would otherwise fill before the next look, instead of leaving that
+ * to the engine's last-ditch GC in the middle of an allocation.
+ *
+ * A GC callback on the same runtime times every collection and notes the
+ * heap before and after.  gcStats() returns what it has gathered, and
+ * gcStats(true) also prints it.  With --gc-stats FILE (JS_GC_STATS) the
+ * shell prints it to FILE at exit, or to stderr if FILE is "-".  The
+ * report shows the pause histogram, GC time as a share of the run, and the
+ * peak heap.  That is enough to tell a GC-bound run from an
+ * interpreter-bound one.
+ */
+
+#include <time.h>
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+#include "jscntxt.h"
+
+#define GC_POLICY_FIXED         0
+#define GC_POLICY_ADAPTIVE      1
+
+#define GC_CHECK_BRANCHES       0x4000
+#define GC_CHECK_MIN_BRANCHES   0x400
+#define GC_CHECK_MAX_BRANCHES   0x40000
+
+typedef struct GCPolicy {
+    uint32      maxBytes;
+    double      trigger;
+    double      interval;       /* in seconds */
+    int         policy;
+    JSBool      batch;          /* only collect when nearly full */
+} GCPolicy;
+
+static GCPolicy gGCPolicy = {
+    64L * 1024L * 1024L, 1.5, 0.0, GC_POLICY_FIXED, JS_FALSE
+};
+
+/* What the branch callback keeps about the shell's own runtime. */
+typedef struct GCPolicyState {
+    JSRuntime   *rt;
+    uint32      branches;
+    uint32      checkEvery;     /* branches between looks at the heap */
+    uint32      lastBytes;      /* gcBytes at the last look */
+    uint32      growth;         /* and how much it grew over the one before */
+    double      lastCollect;
+} GCPolicyState;
+
+static GCPolicyState gGCState;
+
+/* Upper bounds of the pause histogram's buckets, in milliseconds. */
+static const double gc_pause_limits[] = {
+    0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250, 500, 1000
+};
+
+#define GC_PAUSE_BUCKETS \
+    (sizeof gc_pause_limits / sizeof gc_pause_limits[0] + 1)
+
+typedef struct GCStats {
+    uint32      count;
+    double      total;          /* seconds spent collecting */
+    double      longest;
+    double      begin;          /* of the collection under way */
+    uint32      beginBytes;
+    uint32      peakBytes;      /* the heap is largest just before a GC */
+    double      freedBytes;
+    uint32      pauses[GC_PAUSE_BUCKETS];
+} GCStats;
+
+/*
+ * This engine has no API for the GC heap's size or limit, so they are read
+ * from the private JSRuntime in jscntxt.h.  That ties the shell to the
+ * struct layout of the engine it is built against; every such access goes
+ * through these.
+ */
+static uint32
+GCHeapBytes(JSRuntime *rt)
+{
+    return rt->gcBytes;
+}
+
+static uint32
+GCLastBytes(JSRuntime *rt)
+{
+    return rt->gcLastBytes;
+}
+
+static uint32
+GCMaxBytes(JSRuntime *rt)
+{
+    return rt->gcMaxBytes;
+}
+
+static void
+GCSetMaxBytes(JSRuntime *rt, uint32 maxBytes)
+{
+    rt->gcMaxBytes = maxBytes;
+}
+
+static GCStats gGCStats;
+static double gGCStatsStart;
+static const char *gGCStatsPath = NULL;
+static JSGCCallback gOldGCCallback = NULL;
+
+static double
+GCClock(void)
+{
+#ifdef _WIN32
+    return (double) clock() / CLOCKS_PER_SEC;
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+#endif
+}
+
+static JSBool
+GCParseBytes(const char *s, uint32 *np)
+{
+    char *end;
+    double n;
+
+    n = strtod(s, &end);
+    switch (*end) {
+      case 'k': case 'K': n *= 1024.0; end++; break;
+      case 'm': case 'M': n *= 1024.0 * 1024.0; end++; break;
+      case 'g': case 'G': n *= 1024.0 * 1024.0 * 1024.0; end++; break;
+    }
+    if (*end || !(n >= 1024.0 * 1024.0) || n > 4294967295.0)
+        return JS_FALSE;
+    *np = (uint32) n;
+    return JS_TRUE;
+}
+
+/*
+ * Apply a --gc-* option, and to cx's runtime as well when cx isn't NULL.
+ * Returns false if name isn't one, or after complaining about value.
+ */
+static JSBool
+GCPolicyOption(JSContext *cx, const char *name, const char *value)
+{
+    char *end;
+    double d;
+
+    if (!strcmp(name, "--gc-max-bytes")) {
+        if (!GCParseBytes(value, &gGCPolicy.maxBytes))
+            goto bad;
+        if (cx)
+            GCSetMaxBytes(JS_GetRuntime(cx), gGCPolicy.maxBytes);
+    } else if (!strcmp(name, "--gc-trigger")) {
+        d = strtod(value, &end);
+        if (*end || !(d >= 1.0))
+            goto bad;
+        gGCPolicy.trigger = d;
+    } else if (!strcmp(name, "--gc-interval")) {
+        d = strtod(value, &end);
+        if (*end || !(d >= 0.0))
+            goto bad;
+        gGCPolicy.interval = d / 1000.0;
+    } else if (!strcmp(name, "--gc-stats")) {
+        gGCStatsPath = value;
+    } else if (!strcmp(name, "--gc-policy")) {
+        if (!strcmp(value, "fixed"))
+            gGCPolicy.policy = GC_POLICY_FIXED;
+        else if (!strcmp(value, "adaptive"))
+            gGCPolicy.policy = GC_POLICY_ADAPTIVE;
+        else
+            goto bad;
+    } else {
+        return JS_FALSE;
+    }
+    return JS_TRUE;
+
+  bad:
+    fprintf(gErrFile, "bad value for %s: %s\n", name, value);
+    return JS_FALSE;
+}
+
+/* Take the settings from the environment; bad ones are reported and left. */
+static void
+GCPolicyFromEnvironment(void)
+{
+    static const struct {
+        const char  *env;
+        const char  *option;
+    } vars[] = {
+        {"JS_GC_MAX_BYTES",     "--gc-max-bytes"},
+        {"JS_GC_TRIGGER",       "--gc-trigger"},
+        {"JS_GC_INTERVAL",      "--gc-interval"},
+        {"JS_GC_POLICY",        "--gc-policy"},
+        {"JS_GC_STATS",         "--gc-stats"},
+        {0, 0}
+    };
+    const char *value;
+    int i;
+
+    for (i = 0; vars[i].env; i++) {
+        value = getenv(vars[i].env);
+        if (value && *value)
+            (void) GCPolicyOption(NULL, vars[i].option, value);
+    }
+}
+
+static void
+GCPolicyCollect(JSContext *cx, GCPolicyState *st)
+{
+    JS_GC(cx);
+    st->lastCollect = GCClock();
+    st->lastBytes = GCHeapBytes(st->rt);
+    st->growth = 0;
+}
+
+static void
+GCPolicyCheck(JSContext *cx, GCPolicyState *st)
+{
+    JSRuntime *rt = st->rt;
+    uint32 bytes, after, limit, room;
+    JSBool full;
+
+    bytes = GCHeapBytes(rt);
+    after = GCLastBytes(rt);
+    limit = GCMaxBytes(rt);
+    room = (bytes < limit) ? limit - bytes : 0;
+    if (gGCPolicy.policy == GC_POLICY_ADAPTIVE) {
+        /* A drop means the engine collected since; start measuring again. */
+        st->growth = (bytes > st->lastBytes) ? bytes - st->lastBytes : 0;
+        if (st->growth > room / 8) {
+            if (st->checkEvery > GC_CHECK_MIN_BRANCHES)
+                st->checkEvery /= 2;
+        } else if (st->growth < room / 64) {
+            if (st->checkEvery < GC_CHECK_MAX_BRANCHES)
+                st->checkEvery *= 2;
+        }
+    }
+    st->lastBytes = bytes;
+
+    if (bytes <= 8192)
+        return;
+
+    /*
+     * Nearly full: three quarters of the room the last GC left is gone.
+     * Before the first GC after is 0, so that is three quarters of limit.
+     */
+    full = after < limit && bytes > after &&
+           (bytes - after >= (limit - after) / 4 * 3 ||
+            (gGCPolicy.policy == GC_POLICY_ADAPTIVE && st->growth >= room));
+    if (!full && GCClock() - st->lastCollect < gGCPolicy.interval)
+        return;
+    if (full || (!gGCPolicy.batch && bytes > after * gGCPolicy.trigger))
+        GCPolicyCollect(cx, st);
+}
+
+/*
+ * The shell's branch callback, or the tail of one.  Other runtimes than the
+ * shell's own (a Worker's) just get JS_MaybeGC now and then.
+ */
+static JSBool
+GCBranchCallback(JSContext *cx, JSScript *script)
+{
+    GCPolicyState *st = &gGCState;
+
+    if (++st->branches < st->checkEvery)
+        return JS_TRUE;
+    st->branches = 0;
+    if (JS_GetRuntime(cx) == st->rt)
+        GCPolicyCheck(cx, st);
+    else
+        JS_MaybeGC(cx);
+    return JS_TRUE;
+}
+
+static JSBool
+GCStatsCallback(JSContext *cx, JSGCStatus status)
+{
+    GCStats *gs = &gGCStats;
+    double pause;
+    uint32 bytes, i;
+
+    bytes = GCHeapBytes(JS_GetRuntime(cx));
+    if (status == JSGC_BEGIN) {
+        gs->begin = GCClock();
+        gs->beginBytes = bytes;
+        if (bytes > gs->peakBytes)
+            gs->peakBytes = bytes;
+    } else if (status == JSGC_END && gs->begin != 0) {
+        pause = GCClock() - gs->begin;
+        gs->begin = 0;
+        gs->count++;
+        gs->total += pause;
+        if (pause > gs->longest)
+            gs->longest = pause;
+        if (gs->beginBytes > bytes)
+            gs->freedBytes += gs->beginBytes - bytes;
+        for (i = 0; i < GC_PAUSE_BUCKETS - 1; i++) {
+            if (pause * 1000.0 < gc_pause_limits[i])
+                break;
+        }
+        gs->pauses[i]++;
+    }
+    return gOldGCCallback ? gOldGCCallback(cx, status) : JS_TRUE;
+}
+
+/*
+ * For a one-shot run that will exit soon anyway: collect only under real
+ * memory pressure, when the heap is nearly full.
+ */
+static void
+GCPolicyBatch(void)
+{
+    gGCPolicy.batch = JS_TRUE;
+    gGCPolicy.interval = 0;
+}
+
+/* Put cx, on the shell's own runtime, under the policy and the stats. */
+static void
+GCPolicyInstall(JSContext *cx)
+{
+    GCPolicyState *st = &gGCState;
+
+    memset(st, 0, sizeof *st);
+    st->rt = JS_GetRuntime(cx);
+    st->checkEvery = GC_CHECK_BRANCHES;
+    st->lastCollect = GCClock();
+    JS_SetBranchCallback(cx, GCBranchCallback);
+
+    memset(&gGCStats, 0, sizeof gGCStats);
+    gGCStatsStart = st->lastCollect;
+    gOldGCCallback = JS_SetGCCallback(cx, GCStatsCallback);
+}
+
+static void
+GCStatsPrint(JSContext *cx, FILE *f)
+{
+    GCStats *gs = &gGCStats;
+    JSRuntime *rt;
+    double run;
+    uint32 bytes, i;
+
+    rt = JS_GetRuntime(cx);
+    bytes = GCHeapBytes(rt);
+    run = GCClock() - gGCStatsStart;
+    fprintf(f, "gc: %lu collections, %.3f ms of %.3f ms (%.1f%%), "
+               "longest %.3f ms\n",
+            (unsigned long) gs->count, gs->total * 1000.0, run * 1000.0,
+            run > 0 ? 100.0 * gs->total / run : 0.0, gs->longest * 1000.0);
+    fprintf(f, "gc: heap peak %lu, now %lu, limit %lu, freed %.0f bytes\n",
+            (unsigned long) (bytes > gs->peakBytes ? bytes : gs->peakBytes),
+            (unsigned long) bytes, (unsigned long) GCMaxBytes(rt),
+            gs->freedBytes);
+    for (i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        if (gs->pauses[i] == 0)
+            continue;
+        if (i < GC_PAUSE_BUCKETS - 1)
+            fprintf(f, "gc:   < %6.2f ms %8lu\n", gc_pause_limits[i],
+                    (unsigned long) gs->pauses[i]);
+        else
+            fprintf(f, "gc:  >= %6.2f ms %8lu\n", gc_pause_limits[i - 1],
+                    (unsigned long) gs->pauses[i]);
+    }
+}
+
+/* Print the stats where --gc-stats said, if it did; for the end of main. */
+static void
+GCStatsReport(JSContext *cx)
+{
+    FILE *f;
+
+    if (!gGCStatsPath)
+        return;
+    if (!strcmp(gGCStatsPath, "-")) {
+        GCStatsPrint(cx, gErrFile);
+        return;
+    }
+    f = fopen(gGCStatsPath, "w");
+    if (!f) {
+        fprintf(gErrFile, "can't open %s: %s\n", gGCStatsPath,
+                strerror(errno));
+        return;
+    }
+    GCStatsPrint(cx, f);
+    fclose(f);
+}
+
+static JSBool
+GCStatsDefine(JSContext *cx, JSObject *obj, const char *name, jsdouble d)
+{
+    jsval v;
+
+    return JS_NewNumberValue(cx, d, &v) &&
+           JS_DefineProperty(cx, obj, name, v, NULL, NULL, JSPROP_ENUMERATE);
+}
+
+/*
+ * gcStats([print]) returns {collections, gcTime, runTime, longestPause,
+ * peakBytes, bytes, maxBytes, freedBytes, pauseLimits, pauseCounts}, times
+ * in milliseconds.  pauseCounts[i] counts the pauses shorter than
+ * pauseLimits[i] and not counted before it; the last counts the rest.
+ */
+static JSBool
+gcStats(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
+{
+    GCStats *gs = &gGCStats;
+    JSRuntime *rt;
+    JSObject *stats, *limits, *counts;
+    JSBool print;
+    jsval v;
+    uint32 bytes, i;
+
+    print = JS_FALSE;
+    if (argc > 0 && !JS_ValueToBoolean(cx, argv[0], &print))
+        return JS_FALSE;
+    if (print)
+        GCStatsPrint(cx, gErrFile);
+
+    rt = JS_GetRuntime(cx);
+    bytes = GCHeapBytes(rt);
+    stats = JS_NewObject(cx, NULL, NULL, NULL);
+    if (!stats)
+        return JS_FALSE;
+    *rval = OBJECT_TO_JSVAL(stats);
+    if (!GCStatsDefine(cx, stats, "collections", gs->count) ||
+        !GCStatsDefine(cx, stats, "gcTime", gs->total * 1000.0) ||
+        !GCStatsDefine(cx, stats, "runTime",
+                       (GCClock() - gGCStatsStart) * 1000.0) ||
+        !GCStatsDefine(cx, stats, "longestPause", gs->longest * 1000.0) ||
+        !GCStatsDefine(cx, stats, "peakBytes",
+                       bytes > gs->peakBytes ? bytes : gs->peakBytes) ||
+        !GCStatsDefine(cx, stats, "bytes", bytes) ||
+        !GCStatsDefine(cx, stats, "maxBytes", GCMaxBytes(rt)) ||
+        !GCStatsDefine(cx, stats, "freedBytes", gs->freedBytes)) {
+        return JS_FALSE;
+    }
+
+    limits = JS_NewArrayObject(cx, 0, NULL);
+    if (!limits ||
+        !JS_DefineProperty(cx, stats, "pauseLimits", OBJECT_TO_JSVAL(limits),
+                           NULL, NULL, JSPROP_ENUMERATE)) {
+        return JS_FALSE;
+    }
+    counts = JS_NewArrayObject(cx, 0, NULL);
+    if (!counts ||
+        !JS_DefineProperty(cx, stats, "pauseCounts", OBJECT_TO_JSVAL(counts),
+                           NULL, NULL, JSPROP_ENUMERATE)) {
+        return JS_FALSE;
+    }
+    for (i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        if (i < GC_PAUSE_BUCKETS - 1) {
+            if (!JS_NewNumberValue(cx, gc_pause_limits[i], &v) ||
+                !JS_DefineElement(cx, limits, i, v, NULL, NULL,
+                                  JSPROP_ENUMERATE)) {
+                return JS_FALSE;
+            }
+        }
+        if (!JS_NewNumberValue(cx, gs->pauses[i], &v) ||
+            !JS_DefineElement(cx, counts, i, v, NULL, NULL,
+                              JSPROP_ENUMERATE)) {
+            return JS_FALSE;
+        }
+    }
+    return JS_TRUE;
+}
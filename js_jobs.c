@@ -0,0 +1,434 @@
+/*
+ * Job manifests for js_min --jobs FILE.
+ *
+ * modifications (C) Liam Wilson 2025 under the same license as js.c
+ *
+ * Each line of a manifest is a js_min command line: words separated by
+ * blanks, '#' to the end of the line a comment.  A line may begin with
+ * "NAME:" to name its job, followed by "after=DEP[,DEP...]" to hold it back
+ * until the named jobs have succeeded:
+ *
+ *     cjsawk: cjsawk_smold.js --cmd pipeline ../m2min_v3 cjsawk_full.c cjsawk.exe
+ *     m0:     cjsawk_smold.js --cmd pipeline ../m2min_v3 m0_full.c m0.exe
+ *     check:  after=cjsawk,m0 check.js cjsawk.exe m0.exe
+ *
+ * Every job runs in a fresh global on this shell's runtime and context, and
+ * its exit code and time go to stderr.  By default jobs run here one at a
+ * time, in manifest order as their dependencies allow.
+ *
+ * With --parallel N (Unix only), on either side of --jobs, up to N ready
+ * jobs run at once, each in a child forked off this shell.  A child's
+ * stderr is collected and shown when it ends, so concurrent jobs' messages
+ * don't interleave.
+ *
+ * Either way the first failure stops the build: running jobs are killed,
+ * nothing more is started, and the jobs left over are reported as not run.
+ */
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/wait.h>
+#endif
+
+/*
+ * Run argv as a command line in a new global and return its exit code,
+ * leaving the shell's own settings as they were.
+ */
+typedef int (*JobHook)(JSContext *cx, char **argv, int argc);
+
+#define JOB_WAITING     0
+#define JOB_RUNNING     1
+#define JOB_DONE        2
+#define JOB_FAILED      3
+
+typedef struct ManifestJob {
+    const char  *name;          /* NULL for an unnamed line */
+    char        **deps;
+    int         ndeps;
+    char        **argv;
+    int         argc;
+    int         lineno;
+    int         state;
+    int         status;
+    double      start;
+#ifndef _WIN32
+    pid_t       pid;
+    FILE        *err;           /* the child's collected stderr */
+#endif
+} ManifestJob;
+
+typedef struct Manifest {
+    const char  *path;
+    char        *buf;
+    char        **words;        /* every job's deps and argv */
+    ManifestJob *jobs;
+    int         njobs;
+} Manifest;
+
+static double
+JobClock(void)
+{
+#ifdef _WIN32
+    return (double) clock() / CLOCKS_PER_SEC;
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+#endif
+}
+
+static ManifestJob *
+ManifestFind(Manifest *m, const char *name)
+{
+    int i;
+
+    for (i = 0; i < m->njobs; i++) {
+        if (m->jobs[i].name && !strcmp(m->jobs[i].name, name))
+            return &m->jobs[i];
+    }
+    return NULL;
+}
+
+static void
+ManifestFree(JSContext *cx, Manifest *m)
+{
+    if (m->jobs)
+        JS_free(cx, m->jobs);
+    if (m->words)
+        JS_free(cx, m->words);
+    if (m->buf)
+        JS_free(cx, m->buf);
+}
+
+/* Read and check the manifest at path, returning 0 or an exit code. */
+static int
+ManifestParse(JSContext *cx, const char *path, Manifest *m)
+{
+    FILE *file;
+    char *tmp, *line, *next, *s, *dep;
+    char **w;
+    size_t len;
+    int lineno, i, j;
+    ManifestJob *job;
+
+    memset(m, 0, sizeof *m);
+    m->path = path;
+    file = fopen(path, "r");
+    if (!file) {
+        fprintf(gErrFile, "can't open %s: %s\n", path, strerror(errno));
+        return EXITCODE_FILE_NOT_FOUND;
+    }
+    m->buf = ScriptCacheSlurp(cx, file, &len);
+    fclose(file);
+    if (!m->buf)
+        return 1;
+    tmp = (char *) JS_realloc(cx, m->buf, len + 1);
+    if (!tmp)
+        return 1;
+    m->buf = tmp;
+    m->buf[len] = '\0';
+
+    /*
+     * Words, names and deps are all separated, so a line of k of them is at
+     * least 2k characters long with its newline, and has room for them and
+     * the NULL that ends its argv.
+     */
+    m->words = (char **) JS_malloc(cx, (len + 2) * sizeof *m->words);
+    m->jobs = (ManifestJob *) JS_malloc(cx, (len / 2 + 2) * sizeof *m->jobs);
+    if (!m->words || !m->jobs)
+        return 1;
+
+    w = m->words;
+    lineno = 0;
+    for (line = m->buf; line < m->buf + len; line = next) {
+        lineno++;
+        next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+        else
+            next = m->buf + len;
+        s = strchr(line, '#');
+        if (s)
+            *s = '\0';
+
+        job = &m->jobs[m->njobs];
+        memset(job, 0, sizeof *job);
+        job->lineno = lineno;
+        job->deps = w;
+        s = strtok(line, " \t\r");
+        if (s && s[strlen(s) - 1] == ':') {
+            s[strlen(s) - 1] = '\0';
+            job->name = s;
+            s = strtok(NULL, " \t\r");
+        }
+        if (s && !strncmp(s, "after=", 6)) {
+            for (dep = s + 6; *dep; dep = s) {
+                s = dep + strcspn(dep, ",");
+                if (*s)
+                    *s++ = '\0';
+                if (*dep)
+                    job->deps[job->ndeps++] = dep;
+            }
+            w += job->ndeps;
+            s = strtok(NULL, " \t\r");
+        }
+        job->argv = w;
+        for (; s; s = strtok(NULL, " \t\r"))
+            job->argv[job->argc++] = s;
+        if (job->argc == 0) {
+            if (job->name || job->ndeps) {
+                fprintf(gErrFile, "%s:%d: job has no command\n", path, lineno);
+                return 2;
+            }
+            continue;
+        }
+        job->argv[job->argc] = NULL;    /* as ProcessArgs expects */
+        w += job->argc + 1;
+        m->njobs++;
+    }
+
+    for (i = 0; i < m->njobs; i++) {
+        job = &m->jobs[i];
+        if (job->name && ManifestFind(m, job->name) != job) {
+            fprintf(gErrFile, "%s:%d: duplicate job %s\n",
+                    path, job->lineno, job->name);
+            return 2;
+        }
+        for (j = 0; j < job->ndeps; j++) {
+            if (!ManifestFind(m, job->deps[j])) {
+                fprintf(gErrFile, "%s:%d: no job named %s\n",
+                        path, job->lineno, job->deps[j]);
+                return 2;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * Whether a waiting job may start (JOB_RUNNING), must keep waiting
+ * (JOB_WAITING) or never can (JOB_FAILED).
+ */
+static int
+ManifestReady(Manifest *m, ManifestJob *job)
+{
+    int i, state;
+    ManifestJob *dep;
+
+    state = JOB_RUNNING;
+    for (i = 0; i < job->ndeps; i++) {
+        dep = ManifestFind(m, job->deps[i]);
+        if (dep->state == JOB_FAILED)
+            return JOB_FAILED;
+        if (dep->state != JOB_DONE)
+            state = JOB_WAITING;
+    }
+    return state;
+}
+
+static void
+ManifestReport(Manifest *m, ManifestJob *job, const char *what)
+{
+    fprintf(gErrFile, "%s:%d: %s%s", m->path, job->lineno,
+            job->name ? job->name : "", job->name ? ": " : "");
+    if (what)
+        fprintf(gErrFile, "%s\n", what);
+    else
+        fprintf(gErrFile, "exit %d, %.3f s\n", job->status,
+                JobClock() - job->start);
+}
+
+/* Complain about jobs still waiting once nothing else can run. */
+static int
+ManifestCheckStuck(Manifest *m)
+{
+    int i, result;
+
+    result = 0;
+    for (i = 0; i < m->njobs; i++) {
+        if (m->jobs[i].state == JOB_WAITING) {
+            ManifestReport(m, &m->jobs[i], "not run: dependency cycle");
+            result = 1;
+        }
+    }
+    return result;
+}
+
+/* Report the jobs a failure kept from starting, and return result. */
+static int
+ManifestStopped(Manifest *m, int result)
+{
+    int i;
+
+    for (i = 0; i < m->njobs; i++) {
+        if (m->jobs[i].state == JOB_WAITING)
+            ManifestReport(m, &m->jobs[i], "not run: build stopped");
+    }
+    return result;
+}
+
+static int
+ManifestRun(JSContext *cx, Manifest *m, JobHook hook)
+{
+    ManifestJob *job;
+    JSBool progress;
+
+    do {
+        progress = JS_FALSE;
+        for (job = m->jobs; job < m->jobs + m->njobs; job++) {
+            if (job->state != JOB_WAITING)
+                continue;
+            switch (ManifestReady(m, job)) {
+              case JOB_FAILED:
+                job->state = JOB_FAILED;
+                ManifestReport(m, job, "not run: a dependency failed");
+                progress = JS_TRUE;
+                break;
+              case JOB_RUNNING:
+                job->start = JobClock();
+                job->status = hook(cx, job->argv, job->argc);
+                job->state = job->status ? JOB_FAILED : JOB_DONE;
+                fflush(gOutFile);
+                ManifestReport(m, job, NULL);
+                if (job->status != 0)
+                    return ManifestStopped(m, job->status);
+                progress = JS_TRUE;
+                break;
+            }
+        }
+    } while (progress);
+
+    return ManifestCheckStuck(m);
+}
+
+#ifndef _WIN32
+static JSBool
+ManifestStart(JSContext *cx, Manifest *m, ManifestJob *job, JobHook hook)
+{
+    int status;
+
+    job->err = tmpfile();
+    if (!job->err) {
+        fprintf(gErrFile, "can't create a temporary file: %s\n",
+                strerror(errno));
+        return JS_FALSE;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    job->start = JobClock();
+    job->pid = fork();
+    if (job->pid < 0) {
+        fprintf(gErrFile, "fork: %s\n", strerror(errno));
+        fclose(job->err);
+        job->err = NULL;
+        return JS_FALSE;
+    }
+    if (job->pid == 0) {
+        dup2(fileno(job->err), 2);
+        status = hook(cx, job->argv, job->argc);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(status);
+    }
+    job->state = JOB_RUNNING;
+    return JS_TRUE;
+}
+
+/* Show what a finished child wrote to stderr, then how it went. */
+static void
+ManifestFinish(Manifest *m, ManifestJob *job, int wstatus)
+{
+    char chunk[4096];
+    size_t n;
+
+    job->status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus)
+                                     : 128 + WTERMSIG(wstatus);
+    job->state = job->status ? JOB_FAILED : JOB_DONE;
+    rewind(job->err);
+    while ((n = fread(chunk, 1, sizeof chunk, job->err)) > 0)
+        fwrite(chunk, 1, n, gErrFile);
+    fclose(job->err);
+    job->err = NULL;
+    ManifestReport(m, job, NULL);
+}
+
+static int
+ManifestRunParallel(JSContext *cx, Manifest *m, JobHook hook, int maxJobs)
+{
+    ManifestJob *job;
+    int running, result, wstatus;
+    pid_t pid;
+
+    running = 0;
+    result = 0;
+    for (;;) {
+        for (job = m->jobs;
+             job < m->jobs + m->njobs && running < maxJobs && result == 0;
+             job++) {
+            if (job->state != JOB_WAITING ||
+                ManifestReady(m, job) != JOB_RUNNING) {
+                continue;
+            }
+            if (!ManifestStart(cx, m, job, hook)) {
+                result = 1;
+                break;
+            }
+            running++;
+        }
+        if (running == 0)
+            break;
+
+        pid = waitpid(-1, &wstatus, 0);
+        if (pid < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(gErrFile, "waitpid: %s\n", strerror(errno));
+            return 1;
+        }
+        for (job = m->jobs; job < m->jobs + m->njobs; job++) {
+            if (job->state == JOB_RUNNING && job->pid == pid)
+                break;
+        }
+        if (job == m->jobs + m->njobs)
+            continue;
+        running--;
+        ManifestFinish(m, job, wstatus);
+
+        if (job->status != 0 && result == 0) {
+            /* Fail fast: stop the rest of the build. */
+            result = job->status;
+            for (job = m->jobs; job < m->jobs + m->njobs; job++) {
+                if (job->state == JOB_RUNNING)
+                    kill(job->pid, SIGTERM);
+            }
+        }
+    }
+
+    return result ? ManifestStopped(m, result) : ManifestCheckStuck(m);
+}
+#endif
+
+/* Run the manifest at path, parallel jobs at a time; see above. */
+static int
+RunManifest(JSContext *cx, const char *path, JobHook hook, int parallel)
+{
+    Manifest m;
+    int result;
+
+    result = ManifestParse(cx, path, &m);
+    if (result != 0) {
+        ManifestFree(cx, &m);
+        return result;
+    }
+
+    gScriptMemCache = JS_TRUE;
+#ifndef _WIN32
+    if (parallel > 1)
+        result = ManifestRunParallel(cx, &m, hook, parallel);
+    else
+#endif
+        result = ManifestRun(cx, &m, hook);
+    ManifestFree(cx, &m);
+    return result;
+}
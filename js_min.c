@@ -45,6 +45,11 @@
 #include <string.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <time.h>
+#ifndef _WIN32
+#include <sys/time.h>
+#include <unistd.h>
+#endif
 
 #include "jsstddef.h"
 #include "jsapi.h"
@@ -59,6 +64,15 @@ FILE *gOutFile = NULL;
 
 static JSBool reportWarnings = JS_TRUE;
 
+#include "js_cache.c"
+#include "js_gc.c"
+#include "js_jobs.c"
+#ifndef _WIN32
+#include "js_serve.c"
+#include "js_preload.c"
+#include "js_profile.c"
+#endif
+
 static void
 Process(JSContext *cx, JSObject *obj, char *filename)
 {
@@ -66,16 +80,19 @@ Process(JSContext *cx, JSObject *obj, char *filename)
     jsval result;
     FILE *file;
 
-    file = fopen(filename, "r");
-    if (!file) {
-        printf("Process: file not found: %s\n", filename);
-        gExitCode = EXITCODE_FILE_NOT_FOUND;
-        return;
+    file = NULL;
+    if (!FindEmbeddedScript(filename)) {
+        file = fopen(filename, "r");
+        if (!file) {
+            printf("Process: file not found: %s\n", filename);
+            gExitCode = EXITCODE_FILE_NOT_FOUND;
+            return;
+        }
     }
 
     JS_SetThreadStackLimit(cx, 0);
 
-    script = JS_CompileFileHandle(cx, obj, filename, file);
+    script = CompileFileCached(cx, obj, filename, file);
     if (script) {
         (void)JS_ExecuteScript(cx, obj, script, &result);
         JS_DestroyScript(cx, script);
@@ -83,12 +100,195 @@ Process(JSContext *cx, JSObject *obj, char *filename)
     return;
 }
 
+static int
+usage(void)
+{
+    fprintf(gErrFile, "usage: js_min [--script-cache DIR] [--batch] "
+                      "scriptfile [scriptarg...]\n"
+                      "       js_min --embed OUT.c scriptfile...\n"
+                      "       js_min [--script-cache DIR] [--parallel N] "
+                      "--jobs FILE\n"
+                      "       js_min [--script-cache DIR] --serve SOCKET\n"
+                      "       js_min [--script-cache DIR] [--prelude FILE] "
+                      "--zygote SOCKET\n"
+                      "       js_min [--preload FILE]... [--profile=FILE] "
+                      "scriptfile [scriptarg...]\n"
+                      "GC options, before any of the above: --gc-max-bytes N "
+                      "--gc-trigger RATIO\n"
+                      "       --gc-interval MS --gc-policy fixed|adaptive "
+                      "--gc-stats FILE\n");
+    return 2;
+}
+
+/*
+ * Compile each script and write its XDR bytes into OUT.c as the table that
+ * a shell image built with -DEMBEDDED_SCRIPTS links in (see mk_image).  The
+ * first script is the image's main script.
+ */
+static int
+EmbedScripts(JSContext *cx, JSObject *obj, const char *out, char **scripts,
+             int n)
+{
+    FILE *f;
+    int i, result;
+    uint32 j, length;
+    JSScript *script;
+    JSXDRState *xdr;
+    unsigned char *data;
+
+    f = fopen(out, "w");
+    if (!f) {
+        fprintf(gErrFile, "can't open %s: %s\n", out, strerror(errno));
+        return 1;
+    }
+    fprintf(f, "/* Generated by js_min --embed; do not edit. */\n\n"
+               "typedef struct EmbeddedScript {\n"
+               "    const char          *name;\n"
+               "    const unsigned char *data;\n"
+               "    unsigned int        length;\n"
+               "} EmbeddedScript;\n");
+
+    result = 0;
+    for (i = 0; i < n && result == 0; i++) {
+        script = JS_CompileFile(cx, obj, scripts[i]);
+        if (!script) {
+            result = EXITCODE_RUNTIME_ERROR;
+            break;
+        }
+        xdr = JS_XDRNewMem(cx, JSXDR_ENCODE);
+        if (!xdr || !JS_XDRScript(xdr, &script)) {
+            fprintf(gErrFile, "can't serialize %s\n", scripts[i]);
+            result = EXITCODE_RUNTIME_ERROR;
+        } else {
+            data = (unsigned char *) JS_XDRMemGetData(xdr, &length);
+            fprintf(f, "\nstatic const unsigned char script%d[] = {", i);
+            for (j = 0; j < length; j++)
+                fprintf(f, "%s0x%02x,", (j % 12) ? " " : "\n    ", data[j]);
+            fprintf(f, "\n};\n");
+        }
+        if (xdr)
+            JS_XDRDestroy(xdr);
+        JS_DestroyScript(cx, script);
+    }
+
+    fprintf(f, "\nconst EmbeddedScript embedded_scripts[] = {\n");
+    for (i = 0; i < n && result == 0; i++) {
+        fprintf(f, "    {\"%s\", script%d, sizeof script%d},\n",
+                ScriptBaseName(scripts[i]), i, i);
+    }
+    fprintf(f, "    {0, 0, 0}\n};\n");
+    if (fclose(f) != 0 && result == 0)
+        result = 1;
+    if (result != 0)
+        remove(out);
+    return result;
+}
+
+static int
+RunJob(JSContext *cx, char **argv, int argc);
+
+static int
+RunForkedJob(JSContext *cx, char **argv, int argc);
+
+static JSBool gInJob = JS_FALSE;
+
+/* Set by --batch: main ends the process without tearing the engine down. */
+static JSBool gBatchExit = JS_FALSE;
+
+#ifndef _WIN32
+/*
+ * Evaluate the prelude, if any, in obj and then fork a child off the warmed
+ * up shell for each job sent to the socket at path.
+ */
+static int
+RunZygote(JSContext *cx, JSObject *obj, const char *prelude, const char *path)
+{
+    JSObject *argsObj;
+
+    if (prelude) {
+        /* Jobs get their own; the prelude sees an empty one. */
+        argsObj = JS_NewArrayObject(cx, 0, NULL);
+        if (!argsObj ||
+            !JS_DefineProperty(cx, obj, "arguments", OBJECT_TO_JSVAL(argsObj),
+                               NULL, NULL, 0)) {
+            return 1;
+        }
+        Process(cx, obj, (char *) prelude);
+        if (gExitCode != 0)
+            return gExitCode;
+        if (JS_IsExceptionPending(cx))
+            return EXITCODE_RUNTIME_ERROR;
+    }
+
+    /* Start every child from a compact heap rather than each collecting. */
+    JS_GC(cx);
+    return ServeLoop(cx, path, RunForkedJob, JS_TRUE);
+}
+#endif
+
 static int
 ProcessArgs(JSContext *cx, JSObject *obj, char **argv, int argc)
 {
     int i, j, length;
     JSObject *argsObj;
     char *filename = NULL;
+    const char *prelude = NULL;
+    const char *profile = NULL;
+    const char *jobs = NULL;
+    int parallel = 1;
+    JSBool batch = JS_FALSE;
+
+    /* Shell options come before the script name; the rest are its own. */
+    for (i = 0; i < argc && argv[i][0] == '-' && argv[i][1] == '-'; i++) {
+        if (!strcmp(argv[i], "--script-cache") && i + 1 < argc) {
+            gScriptCacheDir = argv[++i];
+        } else if (!strcmp(argv[i], "--jobs") && i + 1 < argc && !gInJob) {
+            jobs = argv[++i];
+        } else if (!strcmp(argv[i], "--batch")) {
+            batch = JS_TRUE;
+        } else if (!strcmp(argv[i], "--parallel") && i + 1 < argc) {
+            parallel = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "--gc-", 5) && i + 1 < argc) {
+            if (!GCPolicyOption(cx, argv[i], argv[i + 1]))
+                return usage();
+            i++;
+        } else if (!strcmp(argv[i], "--embed") && i + 1 < argc) {
+            return EmbedScripts(cx, obj, argv[i + 1], argv + i + 2,
+                                argc - i - 2);
+#ifndef _WIN32
+        } else if (!strcmp(argv[i], "--serve") && i + 1 < argc && !gInJob) {
+            return ServeLoop(cx, argv[i + 1], RunJob, JS_FALSE);
+        } else if (!strcmp(argv[i], "--prelude") && i + 1 < argc) {
+            prelude = argv[++i];
+        } else if (!strcmp(argv[i], "--preload") && i + 1 < argc) {
+            PreloadStart(cx, argv[++i]);
+        } else if (!strncmp(argv[i], "--profile=", 10)) {
+            profile = argv[i] + 10;
+        } else if (!strcmp(argv[i], "--profile") && i + 1 < argc) {
+            profile = argv[++i];
+        } else if (!strcmp(argv[i], "--zygote") && i + 1 < argc && !gInJob) {
+            return RunZygote(cx, obj, prelude, argv[i + 1]);
+#endif
+        } else if (gEmbeddedScripts) {
+            /* Leave options we don't know to an image's main script. */
+            break;
+        } else {
+            return usage();
+        }
+    }
+
+    /* After the whole loop, so that --parallel may come on either side. */
+    if (jobs)
+        return RunManifest(cx, jobs, RunJob, parallel);
+
+    /*
+     * An image runs its first embedded script unless told to run another
+     * one, and then every remaining argument is the script's.
+     */
+    if (gEmbeddedScripts && (i == argc || !FindEmbeddedScript(argv[i])))
+        filename = (char *) gEmbeddedScripts[0].name;
+    else
+        filename = argv[i++];
 
     /*
      * Create arguments early and define it to root it, so it's safe from any
@@ -102,8 +302,6 @@ ProcessArgs(JSContext *cx, JSObject *obj, char **argv, int argc)
         return 1;
     }
 
-    i = 1;
-
     length = argc - i;
     for (j = 0; j < length; j++) {
         JSString *str = JS_NewStringCopyZ(cx, argv[i++]);
@@ -115,7 +313,19 @@ ProcessArgs(JSContext *cx, JSObject *obj, char **argv, int argc)
         }
     }
 
-    filename = argv[0];
+    /*
+     * --batch and --profile only count for a script run as the whole
+     * process; the modes that keep a shell going returned above, and a
+     * job's shell goes on.
+     */
+    if (batch && !gInJob) {
+        GCPolicyBatch();
+        gBatchExit = JS_TRUE;
+    }
+#ifndef _WIN32
+    if (profile && !gInJob)
+        ProfileStart(cx, profile);
+#endif
 
     if (filename)
         Process(cx, obj, filename);
@@ -151,7 +361,10 @@ Load(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
         older = JS_SetErrorReporter(cx, my_LoadErrorReporter);
         oldopts = JS_GetOptions(cx);
         JS_SetOptions(cx, oldopts | JSOPTION_COMPILE_N_GO);
-        script = JS_CompileFile(cx, obj, filename);
+#ifndef _WIN32
+        if (!PreloadTake(cx, obj, filename, &script))
+#endif
+            script = CompileFileCached(cx, obj, filename, NULL);
         if (!script) {
             ok = JS_FALSE;
         } else {
@@ -436,21 +649,144 @@ poke32(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
   return JS_TRUE;
 }
 
+#include "js_ffi.c"
+
+#ifndef _WIN32
+static JSObject *
+NewShellGlobal(JSContext *cx);
+
+#include "js_worker.c"
+#endif
+
 static JSFunctionSpec shell_functions[] = {
     {"load",            Load,           1},
     {"print",           Print,          0},
     {"quit",            Quit,           0},
     {"gc",              GC,             0},
+    {"gcStats",         gcStats,        1},
     {"read",            snarf,          1},
     {"get_dlsym",       get_dlsym,      0},
     {"ffi_call",        ffi_call,       9},
+    {"ffi_bind",        ffi_bind,       2},
+    {"ffi_batch",       ffi_batch,      1},
+    {"memcpy",          heap_memcpy,    3},
+    {"memmove",         heap_memmove,   3},
+    {"memset",          heap_memset,    3},
+    {"copyArrayToHeap", copyArrayToHeap, 4},
+    {"copyHeapToArray", copyHeapToArray, 4},
+    {"copyStringToHeap", copyStringToHeap, 2},
+    {"copyHeapToString", copyHeapToString, 2},
     {"peek8",           peek8,          0},
     {"poke8",           poke8,          0},
     {"peek32",          peek32,         0},
     {"poke32",          poke32,         0},
+    {"peek8u",          peek8u,         1},
+    {"peek8s",          peek8s,         1},
+    {"peek16u",         peek16u,        1},
+    {"peek16s",         peek16s,        1},
+    {"peek32u",         peek32u,        1},
+    {"peek32s",         peek32s,        1},
+    {"poke8u",          poke8x,         2},
+    {"poke8s",          poke8x,         2},
+    {"poke16u",         poke16x,        2},
+    {"poke16s",         poke16x,        2},
+    {"poke32u",         poke32x,        2},
+    {"poke32s",         poke32x,        2},
+    {"heap_region",     heap_region,    1},
+    {"readBytes",       readBytes,      3},
+    {"writeFile",       writeFile,      5},
+#ifndef _WIN32
+    {"mapFile",         mapFile,        2},
+    {"mapOutputFile",   mapOutputFile,  2},
+    {"heapSnapshot",    heapSnapshot,   4},
+    {"heapRestore",     heapRestore,    3},
+    {"preload",         preload,        1},
+    {"atomicLoad32",    atomicLoad32,   1},
+    {"atomicStore32",   atomicStore32,  2},
+    {"atomicAdd32",     atomicAdd32,    2},
+    {"atomicCompareExchange32", atomicCompareExchange32, 3},
+    {"fence",           atomicFence,    0},
+#ifdef __linux__
+    {"atomicWait32",    atomicWait32,   3},
+    {"atomicNotify",    atomicNotify,   2},
+#endif
+#endif
     {0}
 };
 
+static JSObject *
+NewShellGlobal(JSContext *cx)
+{
+    JSObject *glob;
+
+    glob = JS_NewObject(cx, &global_class, NULL, NULL);
+    if (!glob)
+        return NULL;
+    JS_SetGlobalObject(cx, glob);
+    if (!JS_InitStandardClasses(cx, glob))
+        return NULL;
+
+    if (!JS_DefineFunctions(cx, glob, shell_functions))
+        return NULL;
+
+    if (!InitByteBufferClass(cx, glob))
+        return NULL;
+#ifndef _WIN32
+    if (!InitWorkerClass(cx, glob))
+        return NULL;
+#endif
+    return glob;
+}
+
+/* Run a --zygote job in its forked child, on top of the prelude's global. */
+static int
+RunForkedJob(JSContext *cx, char **argv, int argc)
+{
+    gExitCode = 0;
+    gInJob = JS_TRUE;
+    return ProcessArgs(cx, JS_GetGlobalObject(cx), argv, argc);
+}
+
+/* Collect after a job once dead jobs' heap regions hold this much. */
+#define JOB_GC_REGION_BYTES     (512L * 1024L * 1024L)
+
+/* Run one --jobs or --serve job's command line in a global of its own. */
+static int
+RunJob(JSContext *cx, char **argv, int argc)
+{
+    JSObject *glob;
+    const char *cacheDir;
+    GCPolicy policy;
+    int result;
+
+    cacheDir = gScriptCacheDir;
+    policy = gGCPolicy;
+    gExitCode = 0;
+    gInJob = JS_TRUE;
+    glob = NewShellGlobal(cx);
+    result = glob ? ProcessArgs(cx, glob, argv, argc) : 1;
+    gInJob = JS_FALSE;
+    gScriptCacheDir = cacheDir;
+    gGCPolicy = policy;
+    GCSetMaxBytes(JS_GetRuntime(cx), policy.maxBytes);
+    JS_ClearPendingException(cx);
+#ifndef _WIN32
+    PreloadDiscard();
+#endif
+
+    /*
+     * The job's global is garbage now.  Leave it to JS_MaybeGC unless the
+     * heap regions it may have left behind, which the GC heap's own
+     * accounting can't see, hold enough address space to matter.
+     */
+    JS_SetGlobalObject(cx, NULL);
+    if (gHeapRegionReserved > JOB_GC_REGION_BYTES)
+        JS_GC(cx);
+    else
+        JS_MaybeGC(cx);
+    return result;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -465,29 +801,47 @@ main(int argc, char **argv)
     argc--;
     argv++;
 
-    rt = JS_NewRuntime(64L * 1024L * 1024L);
+    GCPolicyFromEnvironment();
+    rt = JS_NewRuntime(gGCPolicy.maxBytes);
     if (!rt)
         return 1;
 
     cx = JS_NewContext(rt, gStackChunkSize);
     if (!cx)
         return 1;
+#ifdef JS_THREADSAFE
+    JS_BeginRequest(cx);
+#endif
     JS_SetErrorReporter(cx, my_ErrorReporter);
+    GCPolicyInstall(cx);
 
-    glob = JS_NewObject(cx, &global_class, NULL, NULL);
+    glob = NewShellGlobal(cx);
     if (!glob)
         return 1;
-    if (!JS_InitStandardClasses(cx, glob))
-        return 1;
-
-    if (!JS_DefineFunctions(cx, glob, shell_functions))
-        return 1;
 
     /* Set version only after there is a global object. */
     JS_SetVersion(cx, JSVERSION_DEFAULT);
 
     result = ProcessArgs(cx, glob, argv, argc);
+#ifndef _WIN32
+    ProfileStop(cx);
+#endif
+    GCStatsReport(cx);
+
+    /*
+     * Skip the final GC and freeing every arena and script: the process is
+     * done, and exiting hands all of it back at once.  Only stdio's
+     * buffers, including files a script opened through the FFI, need to be
+     * written out first.
+     */
+    if (gBatchExit) {
+        fflush(NULL);
+        _exit(result);
+    }
 
+#ifdef JS_THREADSAFE
+    JS_EndRequest(cx);
+#endif
     JS_DestroyContext(cx);
     JS_DestroyRuntime(rt);
     JS_ShutDown();
@@ -0,0 +1,309 @@
+/*
+ * Background preloading of scripts for js_min.
+ *
+ * modifications (C) Liam Wilson 2025 under the same license as js.c
+ *
+ * preload(path...) starts a thread for each script that reads it into
+ * memory while the caller carries on, so that a later load() of the same
+ * path finds its source already there.  --preload FILE does the same from
+ * the command line.  Only scripts asked for this way are preloaded, so a
+ * driver that knows its stage scripts overlaps reading them with its own
+ * start-up, and nothing is read that no one will load.
+ *
+ * With a JS_THREADSAFE engine the thread also compiles the script, in a
+ * runtime of its own like a Worker's, and keeps the XDR bytes, which load()
+ * then only has to decode.  Otherwise compiling there would need the engine
+ * lock (see js_worker.c) for the whole parse and gain nothing, so load()
+ * compiles the preloaded source itself, through the script cache as usual.
+ *
+ * A preload is used once, and only if the file is unchanged and the compile
+ * options match; anything else falls back to an ordinary load.  The ones
+ * not taken by the end of a job (--jobs, --serve, --zygote) are dropped,
+ * so a long-lived shell does not keep their sources.  A child forked off
+ * the shell (--zygote, --parallel) can use the preloads its parent had
+ * finished, but not the ones whose threads it left behind.
+ */
+
+#include <pthread.h>
+
+#define PRELOAD_RUNTIME_BYTES   (16L * 1024L * 1024L)
+
+typedef struct PreloadEntry {
+    struct PreloadEntry *next;
+    char        *path;
+    pid_t       owner;          /* the process whose thread fills this in */
+    JSBool      done;
+    uint32      options;        /* JS_GetOptions that load() will have */
+    struct stat sb;             /* of the file as it was read */
+    char        *source;        /* malloc'd, NULL if it couldn't be read */
+    size_t      length;
+    void        *xdr;           /* malloc'd XDR data, if compiled here */
+    uint32      xdrLength;
+} PreloadEntry;
+
+static pthread_mutex_t gPreloadLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gPreloadCond = PTHREAD_COND_INITIALIZER;
+static PreloadEntry *gPreloads = NULL;
+
+/* Keep a fork from catching the lock held by a preload thread. */
+static void
+PreloadForkPrepare(void)
+{
+    pthread_mutex_lock(&gPreloadLock);
+}
+
+static void
+PreloadForkDone(void)
+{
+    pthread_mutex_unlock(&gPreloadLock);
+}
+
+/* Whether this process can use e; call with gPreloadLock held. */
+static JSBool
+PreloadUsable(PreloadEntry *e)
+{
+    return e->done || e->owner == getpid();
+}
+
+static void
+PreloadFree(PreloadEntry *e)
+{
+    free(e->path);
+    free(e->source);
+    free(e->xdr);
+    free(e);
+}
+
+static char *
+PreloadRead(const char *path, struct stat *sb, size_t *lenp)
+{
+    FILE *file;
+    char *buf;
+
+    file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+    buf = NULL;
+    if (fstat(fileno(file), sb) == 0 && S_ISREG(sb->st_mode)) {
+        buf = (char *) malloc(sb->st_size + 1);
+        if (buf && fread(buf, 1, sb->st_size, file) != (size_t) sb->st_size) {
+            free(buf);
+            buf = NULL;
+        }
+        *lenp = sb->st_size;
+    }
+    fclose(file);
+    return buf;
+}
+
+#ifdef JS_THREADSAFE
+static JSClass preload_global_class = {
+    "global", 0,
+    JS_PropertyStub,  JS_PropertyStub,
+    JS_PropertyStub,  JS_PropertyStub,
+    JS_EnumerateStub, JS_ResolveStub,
+    JS_ConvertStub,   JS_FinalizeStub
+};
+
+/* Compile e's source in a throwaway runtime and keep its XDR bytes. */
+static void
+PreloadCompile(PreloadEntry *e)
+{
+    JSRuntime *rt;
+    JSContext *cx;
+    JSObject *glob;
+    JSScript *script;
+    JSXDRState *xdr;
+    void *data;
+    uint32 length;
+
+    rt = JS_NewRuntime(PRELOAD_RUNTIME_BYTES);
+    cx = rt ? JS_NewContext(rt, gStackChunkSize) : NULL;
+    if (cx) {
+        /* Errors are left for load() to report when it compiles again. */
+        JS_BeginRequest(cx);
+        JS_SetOptions(cx, e->options);
+        glob = JS_NewObject(cx, &preload_global_class, NULL, NULL);
+        script = glob ? JS_CompileScript(cx, glob, e->source, e->length,
+                                         e->path, 1)
+                      : NULL;
+        if (script) {
+            xdr = JS_XDRNewMem(cx, JSXDR_ENCODE);
+            if (xdr && JS_XDRScript(xdr, &script)) {
+                data = JS_XDRMemGetData(xdr, &length);
+                e->xdr = malloc(length);
+                if (e->xdr) {
+                    memcpy(e->xdr, data, length);
+                    e->xdrLength = length;
+                }
+            }
+            if (xdr)
+                JS_XDRDestroy(xdr);
+            JS_DestroyScript(cx, script);
+        }
+        JS_EndRequest(cx);
+        JS_DestroyContext(cx);
+    }
+    if (rt)
+        JS_DestroyRuntime(rt);
+}
+#endif
+
+static void *
+PreloadMain(void *arg)
+{
+    PreloadEntry *e = (PreloadEntry *) arg;
+
+    e->source = PreloadRead(e->path, &e->sb, &e->length);
+#ifdef JS_THREADSAFE
+    if (e->source)
+        PreloadCompile(e);
+#endif
+
+    pthread_mutex_lock(&gPreloadLock);
+    e->done = JS_TRUE;
+    pthread_cond_broadcast(&gPreloadCond);
+    pthread_mutex_unlock(&gPreloadLock);
+    return NULL;
+}
+
+/*
+ * Start preloading path for a load() from cx, unless it is embedded or
+ * already on its way.  Failing to start is not an error.
+ */
+static void
+PreloadStart(JSContext *cx, const char *path)
+{
+    static JSBool atforkDone = JS_FALSE;
+    PreloadEntry *e;
+    pthread_t tid;
+
+    if (FindEmbeddedScript(path))
+        return;
+    pthread_mutex_lock(&gPreloadLock);
+    if (!atforkDone) {
+        atforkDone = JS_TRUE;
+        pthread_atfork(PreloadForkPrepare, PreloadForkDone, PreloadForkDone);
+    }
+    for (e = gPreloads; e; e = e->next) {
+        if (PreloadUsable(e) && !strcmp(e->path, path))
+            break;
+    }
+    pthread_mutex_unlock(&gPreloadLock);
+    if (e)
+        return;
+
+    e = (PreloadEntry *) calloc(1, sizeof *e);
+    if (!e)
+        return;
+    e->path = strdup(path);
+    e->owner = getpid();
+    e->options = JS_GetOptions(cx) | JSOPTION_COMPILE_N_GO;
+    if (!e->path || pthread_create(&tid, NULL, PreloadMain, e) != 0) {
+        PreloadFree(e);
+        return;
+    }
+    pthread_detach(tid);
+
+    pthread_mutex_lock(&gPreloadLock);
+    e->next = gPreloads;
+    gPreloads = e;
+    pthread_mutex_unlock(&gPreloadLock);
+}
+
+/*
+ * Drop every preload this process could still take, waiting for the ones
+ * being read.  A forked child's copies of its parent's unfinished entries
+ * are only unlinked: no thread of the child's will ever finish them.
+ */
+static void
+PreloadDiscard(void)
+{
+    PreloadEntry *e, *next, *mine;
+
+    mine = NULL;
+    pthread_mutex_lock(&gPreloadLock);
+    for (e = gPreloads; e; e = next) {
+        next = e->next;
+        if (PreloadUsable(e)) {
+            e->next = mine;
+            mine = e;
+        }
+    }
+    gPreloads = NULL;
+    for (e = mine; e; e = e->next) {
+        while (!e->done)
+            pthread_cond_wait(&gPreloadCond, &gPreloadLock);
+    }
+    pthread_mutex_unlock(&gPreloadLock);
+
+    for (e = mine; e; e = next) {
+        next = e->next;
+        PreloadFree(e);
+    }
+}
+
+/*
+ * Compile filename from its preload, if it has one that is still good,
+ * into *scriptp (NULL after an error) and return true; otherwise return
+ * false for the caller to compile it as usual.
+ */
+static JSBool
+PreloadTake(JSContext *cx, JSObject *obj, const char *filename,
+            JSScript **scriptp)
+{
+    PreloadEntry *e, **ep;
+    struct stat sb;
+    JSScript *script;
+
+    pthread_mutex_lock(&gPreloadLock);
+    for (ep = &gPreloads; (e = *ep) != NULL; ep = &e->next) {
+        if (PreloadUsable(e) && !strcmp(e->path, filename))
+            break;
+    }
+    if (e) {
+        *ep = e->next;
+        while (!e->done)
+            pthread_cond_wait(&gPreloadCond, &gPreloadLock);
+    }
+    pthread_mutex_unlock(&gPreloadLock);
+    if (!e)
+        return JS_FALSE;
+
+    script = NULL;
+    if (e->source && stat(filename, &sb) == 0 &&
+        sb.st_dev == e->sb.st_dev && sb.st_ino == e->sb.st_ino &&
+        sb.st_size == e->sb.st_size && sb.st_mtime == e->sb.st_mtime &&
+        JS_GetOptions(cx) == e->options) {
+        if (e->xdr) {
+            script = DecodeScript(cx, e->xdr, e->xdrLength);
+            if (!script)
+                JS_ClearPendingException(cx);
+        }
+        if (!script) {
+            *scriptp = CompileSourceStored(cx, obj, filename, &e->sb,
+                                           e->source, e->length);
+            PreloadFree(e);
+            return JS_TRUE;
+        }
+    }
+    PreloadFree(e);
+    *scriptp = script;
+    return script != NULL;
+}
+
+static JSBool
+preload(JSContext *cx, JSObject *obj, uintN argc, jsval *argv, jsval *rval)
+{
+    uintN i;
+    JSString *str;
+
+    for (i = 0; i < argc; i++) {
+        str = JS_ValueToString(cx, argv[i]);
+        if (!str)
+            return JS_FALSE;
+        argv[i] = STRING_TO_JSVAL(str);
+        PreloadStart(cx, JS_GetStringBytes(str));
+    }
+    return JS_TRUE;
+}
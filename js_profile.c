@@ -0,0 +1,311 @@
+/*
+ * Sampling profiler for js_min --profile=FILE.
+ *
+ * modifications (C) Liam Wilson 2025 under the same license as js.c
+ *
+ * A SIGPROF interval timer ticks every millisecond of CPU time.  The signal
+ * handler only counts the tick.  The next branch callback walks the JS
+ * stack with the debugger API's frame iterator and charges the ticks to it.
+ * The interpreter is never looked at from inside a signal.  Time spent in
+ * natives, the FFI or the GC goes to whatever stack reaches a backward
+ * branch next, which is normally the caller's.
+ *
+ * At exit FILE gets one line per distinct stack, root first, with frames
+ * separated by ';' and followed by a count.  This is the folded format that
+ * flamegraph.pl and speedscope read.  A function's frame is labelled
+ * "name (file:line)" with the line it starts on.  stderr gets the functions
+ * with the most samples, with their self and total shares, and the source
+ * lines where the most samples stopped.
+ */
+
+#include <signal.h>
+#include "jsdbgapi.h"
+
+#define PROFILE_INTERVAL_US     1000
+#define PROFILE_MAX_FRAMES      128
+#define PROFILE_MAX_LABEL       160
+#define PROFILE_BUCKETS         1024
+#define PROFILE_TOP             20
+
+typedef struct ProfileEntry {
+    struct ProfileEntry *next;
+    uint32      hash;
+    uint32      self;           /* samples with this on top of the stack */
+    uint32      total;          /* samples with this anywhere on it */
+    char        key[1];
+} ProfileEntry;
+
+typedef struct ProfileTable {
+    ProfileEntry *buckets[PROFILE_BUCKETS];
+    uint32      count;
+} ProfileTable;
+
+static volatile sig_atomic_t gProfileTicks = 0;
+static const char *gProfilePath = NULL;
+static JSBranchCallback gProfileNextBranchCallback = NULL;
+static uint32 gProfileSamples = 0;
+static ProfileTable gProfileStacks, gProfileFunctions, gProfileLines;
+
+/* Only ever called on the engine's thread, so these can be shared. */
+static char gProfileLabels[PROFILE_MAX_FRAMES][PROFILE_MAX_LABEL];
+static char gProfileStack[PROFILE_MAX_FRAMES * PROFILE_MAX_LABEL + 16];
+
+static ProfileEntry *
+ProfileLookup(ProfileTable *t, const char *key)
+{
+    ProfileEntry *e, **ep;
+    uint32 h;
+    size_t n;
+
+    n = strlen(key);
+    h = ScriptCacheHash(SCRIPT_CACHE_HASH_INIT, key, n);
+    ep = &t->buckets[h % PROFILE_BUCKETS];
+    for (e = *ep; e; e = e->next) {
+        if (e->hash == h && !strcmp(e->key, key))
+            return e;
+    }
+    e = (ProfileEntry *) malloc(sizeof *e + n);
+    if (!e)
+        return NULL;
+    e->hash = h;
+    e->self = e->total = 0;
+    memcpy(e->key, key, n + 1);
+    e->next = *ep;
+    *ep = e;
+    t->count++;
+    return e;
+}
+
+static void
+ProfileLabel(JSContext *cx, JSStackFrame *fp, char *buf)
+{
+    JSScript *script;
+    JSFunction *fun;
+    const char *file;
+    char *s;
+
+    fun = JS_GetFrameFunction(cx, fp);
+    script = JS_IsNativeFrame(cx, fp) ? NULL : JS_GetFrameScript(cx, fp);
+    file = script ? JS_GetScriptFilename(cx, script) : NULL;
+    file = file ? ScriptBaseName(file) : "?";
+    if (!script) {
+        snprintf(buf, PROFILE_MAX_LABEL, "%s [native]",
+                    fun ? JS_GetFunctionName(fun) : "?");
+    } else if (fun) {
+        snprintf(buf, PROFILE_MAX_LABEL, "%s (%s:%u)",
+                    JS_GetFunctionName(fun), file,
+                    JS_GetScriptBaseLineNumber(cx, script));
+    } else {
+        snprintf(buf, PROFILE_MAX_LABEL, "(top) (%s)", file);
+    }
+
+    /* ';' separates frames in the folded output. */
+    for (s = buf; *s; s++) {
+        if (*s == ';')
+            *s = ',';
+    }
+}
+
+/* Charge weight ticks to cx's current stack. */
+static void
+ProfileSample(JSContext *cx, uint32 weight)
+{
+    JSStackFrame *iter, *fp, *top;
+    JSScript *script;
+    ProfileEntry *e;
+    char line[PROFILE_MAX_LABEL];
+    char *s;
+    int n, i, j;
+
+    iter = NULL;
+    top = NULL;
+    n = 0;
+    while ((fp = JS_FrameIterator(cx, &iter)) != NULL) {
+        if (n == PROFILE_MAX_FRAMES)
+            break;
+        if (!top)
+            top = fp;
+        ProfileLabel(cx, fp, gProfileLabels[n++]);
+    }
+    if (n == 0)
+        return;
+    gProfileSamples += weight;
+
+    /* The iterator goes from the top of the stack; folded stacks don't. */
+    s = gProfileStack;
+    if (fp)
+        s += snprintf(s, sizeof gProfileStack, "[truncated];");
+    for (i = n - 1; i >= 0; i--) {
+        s += snprintf(s, sizeof gProfileStack - (s - gProfileStack),
+                         "%s%s", gProfileLabels[i], i ? ";" : "");
+    }
+    e = ProfileLookup(&gProfileStacks, gProfileStack);
+    if (e)
+        e->self += weight;
+
+    /* Count a recursive function once per sample in its total. */
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < i; j++) {
+            if (!strcmp(gProfileLabels[j], gProfileLabels[i]))
+                break;
+        }
+        if (j < i)
+            continue;
+        e = ProfileLookup(&gProfileFunctions, gProfileLabels[i]);
+        if (e) {
+            e->total += weight;
+            if (i == 0)
+                e->self += weight;
+        }
+    }
+
+    script = JS_IsNativeFrame(cx, top) ? NULL : JS_GetFrameScript(cx, top);
+    if (script) {
+        snprintf(line, sizeof line, "%s:%u",
+                    ScriptBaseName(JS_GetScriptFilename(cx, script)),
+                    JS_PCToLineNumber(cx, script, JS_GetFramePC(cx, top)));
+        e = ProfileLookup(&gProfileLines, line);
+        if (e)
+            e->self += weight;
+    }
+}
+
+static JSBool
+ProfileBranchCallback(JSContext *cx, JSScript *script)
+{
+    uint32 ticks;
+
+    if (gProfileTicks) {
+        ticks = (uint32) gProfileTicks;
+        gProfileTicks = 0;
+        ProfileSample(cx, ticks);
+    }
+    return gProfileNextBranchCallback
+           ? gProfileNextBranchCallback(cx, script)
+           : JS_TRUE;
+}
+
+static void
+ProfileSignal(int sig)
+{
+    gProfileTicks++;
+}
+
+/* Start sampling cx's stacks for a report to path when ProfileStop runs. */
+static JSBool
+ProfileStart(JSContext *cx, const char *path)
+{
+    struct sigaction sa;
+    struct itimerval it;
+
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = ProfileSignal;
+    sa.sa_flags = SA_RESTART;           /* don't fail reads with EINTR */
+    sigemptyset(&sa.sa_mask);
+    memset(&it, 0, sizeof it);
+    it.it_interval.tv_usec = PROFILE_INTERVAL_US;
+    it.it_value = it.it_interval;
+    if (sigaction(SIGPROF, &sa, NULL) < 0 ||
+        setitimer(ITIMER_PROF, &it, NULL) < 0) {
+        fprintf(gErrFile, "can't start the profiler: %s\n", strerror(errno));
+        return JS_FALSE;
+    }
+    gProfilePath = path;
+    gProfileNextBranchCallback = JS_SetBranchCallback(cx,
+                                                      ProfileBranchCallback);
+    return JS_TRUE;
+}
+
+static int
+ProfileCompare(const void *a, const void *b)
+{
+    const ProfileEntry *x = *(const ProfileEntry * const *) a;
+    const ProfileEntry *y = *(const ProfileEntry * const *) b;
+
+    if (x->self != y->self)
+        return (x->self < y->self) ? 1 : -1;
+    if (x->total != y->total)
+        return (x->total < y->total) ? 1 : -1;
+    return strcmp(x->key, y->key);
+}
+
+/* The entries of t, most self samples first, in a malloc'd array. */
+static ProfileEntry **
+ProfileSort(ProfileTable *t)
+{
+    ProfileEntry **v, *e;
+    uint32 i, n;
+
+    v = (ProfileEntry **) malloc((t->count + 1) * sizeof *v);
+    if (!v)
+        return NULL;
+    n = 0;
+    for (i = 0; i < PROFILE_BUCKETS; i++) {
+        for (e = t->buckets[i]; e; e = e->next)
+            v[n++] = e;
+    }
+    qsort(v, n, sizeof *v, ProfileCompare);
+    return v;
+}
+
+static void
+ProfileSummary(void)
+{
+    ProfileEntry **v;
+    double pct;
+    uint32 i;
+
+    pct = gProfileSamples ? 100.0 / gProfileSamples : 0;
+    fprintf(gErrFile, "profile: %lu samples of %d us\n",
+            (unsigned long) gProfileSamples, PROFILE_INTERVAL_US);
+
+    v = ProfileSort(&gProfileFunctions);
+    if (v) {
+        fprintf(gErrFile, "profile:  self%%  total%%  function\n");
+        for (i = 0; i < gProfileFunctions.count && i < PROFILE_TOP; i++) {
+            fprintf(gErrFile, "profile: %6.2f %6.2f  %s\n",
+                    v[i]->self * pct, v[i]->total * pct, v[i]->key);
+        }
+        free(v);
+    }
+    v = ProfileSort(&gProfileLines);
+    if (v) {
+        fprintf(gErrFile, "profile:  self%%  line\n");
+        for (i = 0; i < gProfileLines.count && i < PROFILE_TOP; i++) {
+            fprintf(gErrFile, "profile: %6.2f  %s\n",
+                    v[i]->self * pct, v[i]->key);
+        }
+        free(v);
+    }
+}
+
+/* Stop the timer and write the report, if ProfileStart ran. */
+static void
+ProfileStop(JSContext *cx)
+{
+    struct itimerval it;
+    ProfileEntry *e;
+    FILE *f;
+    uint32 i;
+
+    if (!gProfilePath)
+        return;
+    memset(&it, 0, sizeof it);
+    setitimer(ITIMER_PROF, &it, NULL);
+    signal(SIGPROF, SIG_IGN);
+
+    f = fopen(gProfilePath, "w");
+    if (!f) {
+        fprintf(gErrFile, "can't open %s: %s\n", gProfilePath,
+                strerror(errno));
+    } else {
+        for (i = 0; i < PROFILE_BUCKETS; i++) {
+            for (e = gProfileStacks.buckets[i]; e; e = e->next)
+                fprintf(f, "%s %lu\n", e->key, (unsigned long) e->self);
+        }
+        if (fclose(f) != 0)
+            fprintf(gErrFile, "can't write %s\n", gProfilePath);
+    }
+    ProfileSummary();
+    gProfilePath = NULL;
+}
@@ -0,0 +1,249 @@
+/*
+ * Resident shell mode.
+ *
+ * modifications (C) Liam Wilson 2025 under the same license as js.c
+ *
+ * With --serve SOCKET the shell listens on a Unix domain socket and runs
+ * the jobs that js_client.exe sends it, one after another, in this process.
+ * A job is a working directory plus an argument vector that the shell treats
+ * exactly like its own command line, run in a fresh global object against
+ * the runtime and context already set up.  The in-memory script cache (see
+ * js_cache.c) is on while serving, so a script an earlier job compiled is
+ * neither read nor parsed again while it is unchanged.
+ *
+ * The client passes its stdin, stdout and stderr along with the request and
+ * the job runs with them as its own, so output goes straight to wherever the
+ * client's goes; the reply is the job's exit code.  A job that ends the
+ * process (calling libc exit through the FFI, say) ends the server with it,
+ * and its client then fails.
+ *
+ * With --zygote SOCKET the same loop forks a child per job instead.  The
+ * child runs the job in the already warmed-up global, which it shares with
+ * the server copy-on-write, replies and exits, so jobs are isolated from
+ * each other and from the server and can run concurrently.
+ */
+
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+/* Must match js_client.c. */
+#define SERVE_MAGIC             0x424a534a      /* "JSJB" */
+#define SERVE_MAX_REQUEST       (1 << 20)
+
+typedef struct ServeRequest {
+    uint32      magic;
+    uint32      length;         /* of the NUL-terminated cwd and arguments */
+} ServeRequest;
+
+static int
+ServeListen(const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat sb;
+    int fd;
+
+    if (strlen(path) >= sizeof addr.sun_path) {
+        fprintf(gErrFile, "socket path too long: %s\n", path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    /* Replace a socket left behind by an earlier server, but nothing else. */
+    if (lstat(path, &sb) == 0 && S_ISSOCK(sb.st_mode))
+        unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 ||
+        bind(fd, (struct sockaddr *) &addr, sizeof addr) < 0 ||
+        listen(fd, 16) < 0) {
+        fprintf(gErrFile, "can't listen on %s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * Receive a request and the client's standard fds into fds, which the
+ * caller closes.  Returns the malloc'd, NUL-terminated argument block.
+ */
+static char *
+ServeRecv(int conn, int fds[3], uint32 *lengthp)
+{
+    ServeRequest req;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } control;
+    ssize_t n;
+    uint32 got;
+    char *buf;
+
+    fds[0] = fds[1] = fds[2] = -1;
+    memset(&msg, 0, sizeof msg);
+    iov.iov_base = &req;
+    iov.iov_len = sizeof req;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof control.buf;
+
+    n = recvmsg(conn, &msg, 0);
+    if (n < 0)
+        return NULL;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(3 * sizeof(int))) {
+        memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+    }
+    if (n != sizeof req || req.magic != SERVE_MAGIC || fds[0] < 0 ||
+        req.length == 0 || req.length > SERVE_MAX_REQUEST) {
+        return NULL;
+    }
+
+    buf = (char *) malloc(req.length + 1);
+    if (!buf)
+        return NULL;
+    for (got = 0; got < req.length; got += n) {
+        n = read(conn, buf + got, req.length - got);
+        if (n <= 0) {
+            free(buf);
+            return NULL;
+        }
+    }
+    buf[req.length] = '\0';
+    *lengthp = req.length;
+    return buf;
+}
+
+static int
+ServeJob(JSContext *cx, JobHook hook, int fds[3], char *buf,
+         uint32 length, const char *home)
+{
+    char **argv, *s, *end;
+    int argc, i, saved[3], result;
+
+    argc = 0;
+    end = buf + length;
+    for (s = buf; s < end; s++) {
+        if (*s == '\0')
+            argc++;
+    }
+    /* With buf[length], every string ends in a NUL; that bounds argc. */
+    argv = (char **) malloc((argc + 1) * sizeof *argv);
+    if (!argv)
+        return 1;
+    argc = 0;
+    for (s = buf + strlen(buf) + 1; s < end; s += strlen(s) + 1)
+        argv[argc++] = s;
+    argv[argc] = NULL;
+
+    fflush(stdout);
+    fflush(stderr);
+    for (i = 0; i < 3; i++) {
+        saved[i] = dup(i);
+        dup2(fds[i], i);
+    }
+    clearerr(stdin);
+
+    if (chdir(buf) < 0) {
+        fprintf(gErrFile, "can't change directory to %s: %s\n",
+                buf, strerror(errno));
+        result = 1;
+    } else {
+        result = hook(cx, argv, argc);
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    for (i = 0; i < 3; i++) {
+        dup2(saved[i], i);
+        close(saved[i]);
+    }
+    clearerr(stdin);
+    clearerr(stdout);
+    clearerr(stderr);
+    if (chdir(home) < 0)
+        fprintf(gErrFile, "can't return to %s: %s\n", home, strerror(errno));
+
+    free(argv);
+    return result;
+}
+
+/* Serve jobs on the socket at path until killed, forking for each if asked. */
+static int
+ServeLoop(JSContext *cx, const char *path, JobHook hook, JSBool forkJobs)
+{
+    char home[4096], *buf;
+    int lfd, conn, fds[3], i;
+    int32 status;
+    uint32 length;
+    pid_t pid;
+
+    if (!getcwd(home, sizeof home)) {
+        fprintf(gErrFile, "can't get working directory: %s\n",
+                strerror(errno));
+        return 1;
+    }
+    lfd = ServeListen(path);
+    if (lfd < 0)
+        return 1;
+
+    /* A client that goes away mid-job must not take the server with it. */
+    signal(SIGPIPE, SIG_IGN);
+    if (forkJobs)
+        signal(SIGCHLD, SIG_IGN);       /* children reap themselves */
+    gScriptMemCache = JS_TRUE;
+
+    for (;;) {
+        conn = accept(lfd, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            fprintf(gErrFile, "accept: %s\n", strerror(errno));
+            break;
+        }
+        buf = ServeRecv(conn, fds, &length);
+        if (buf && forkJobs) {
+            fflush(stdout);
+            fflush(stderr);
+            pid = fork();
+            if (pid == 0) {
+                /* The job runs as it would as a process of its own. */
+                signal(SIGPIPE, SIG_DFL);
+                signal(SIGCHLD, SIG_DFL);
+                close(lfd);
+                status = ServeJob(cx, hook, fds, buf, length, home);
+                (void) write(conn, &status, sizeof status);
+                _exit(status);
+            }
+            if (pid < 0) {
+                fprintf(gErrFile, "fork: %s\n", strerror(errno));
+                status = 1;
+                (void) write(conn, &status, sizeof status);
+            }
+            free(buf);
+        } else if (buf) {
+            status = ServeJob(cx, hook, fds, buf, length, home);
+            free(buf);
+            (void) write(conn, &status, sizeof status);
+        }
+        for (i = 0; i < 3; i++) {
+            if (fds[i] >= 0)
+                close(fds[i]);
+        }
+        close(conn);
+    }
+
+    close(lfd);
+    return 1;
+}
@@ -0,0 +1,852 @@
+/*
+ * Worker threads for js_min.
+ *
+ * modifications (C) Liam Wilson 2025 under the same license as js.c
+ *
+ * new Worker(path) starts an OS thread with a runtime, context and global
+ * of its own, set up like the shell's plus postMessage(), receive() and
+ * close(), and runs the script at path there.  If the script leaves an
+ * onmessage function behind, the worker then calls it with each message the
+ * parent posts until the parent calls terminate() or the worker close().
+ *
+ * Messages are copied from one runtime to the other and may be undefined,
+ * null, a boolean, a number, a string, an array of numbers or a ByteBuffer.
+ * postMessage(buf, true) transfers a ByteBuffer's malloc'd bytes instead of
+ * copying them, leaving the sender's buffer and its views empty.
+ *
+ * On the parent's side w.postMessage(v[, transfer]) sends, w.receive()
+ * waits for the next message and returns undefined once the worker has
+ * finished and none are left, w.join() waits for the worker to finish while
+ * handing each message to w.onmessage, and w.terminate() asks it to stop.
+ *
+ * Built with JS_THREADSAFE (THREADSAFE=1 ./mk_min, against a libmozjs made
+ * the same way) the engine locks its own process-wide caches and each worker
+ * runs its JS on a core of its own, in parallel with the parent and the
+ * other workers.  The shell's process-wide tables that workers share are
+ * locked too: the heap region list (js_ffi.c) and the script caches
+ * (js_cache.c).  The GC policy and stats (js_gc.c) and the profiler
+ * (js_profile.c) belong to the main runtime, and workers don't report to
+ * them.  A worker's uncaught error or quit(n) sets the shell's exit status,
+ * as the main script's would.
+ *
+ * Without JS_THREADSAFE those engine caches (dtoa's, the deflated string
+ * cache) must not be used by two threads at once, so threads take turns on
+ * a fair engine lock: a thread holds it while running JS and lets go while
+ * waiting for a message or in atomicWait32, and every few thousand backward
+ * branches.  Workers there only overlap that waiting with other work; they
+ * are no way to use more than one core.
+ */
+
+#include <limits.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#define WORKER_RUNTIME_BYTES    (64L * 1024L * 1024L)
+#define WORKER_YIELD_BRANCHES   4096
+
+#ifdef JS_THREADSAFE
+#define EngineEnter()           ((void) 0)
+#define EngineLeave()           ((void) 0)
+#else
+static pthread_mutex_t gEngineMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gEngineCond = PTHREAD_COND_INITIALIZER;
+static unsigned long gEngineNext = 1;   /* the main thread holds ticket 0 */
+static unsigned long gEngineServing = 0;
+
+/* Wait for our turn on the engine; turns are taken in arrival order. */
+static void
+EngineEnter(void)
+{
+    unsigned long ticket;
+
+    pthread_mutex_lock(&gEngineMutex);
+    ticket = gEngineNext++;
+    while (ticket != gEngineServing)
+        pthread_cond_wait(&gEngineCond, &gEngineMutex);
+    pthread_mutex_unlock(&gEngineMutex);
+}
+
+static void
+EngineLeave(void)
+{
+    pthread_mutex_lock(&gEngineMutex);
+    gEngineServing++;
+    pthread_cond_broadcast(&gEngineCond);
+    pthread_mutex_unlock(&gEngineMutex);
+}
+
+/* The parent's branch callback from before its first Worker, run after ours. */
+static JSBranchCallback gWorkerNextBranchCallback = NULL;
+
+static JSBool
+WorkerBranchCallback(JSContext *cx, JSScript *script)
+{
+    static unsigned int branches = 0;   /* only touched under the lock */
+
+    if (++branches % WORKER_YIELD_BRANCHES == 0) {
+        EngineLeave();
+        EngineEnter();
+    }
+    return gWorkerNextBranchCallback
+           ? gWorkerNextBranchCallback(cx, script)
+           : JS_TRUE;
+}
+#endif
+
+/*
+ * Atomics on heap addresses, for memory shared between workers or with
+ * threads started through the FFI.  An address is taken as by peek32 (so a
+ * ByteBuffer means its first byte) and must be 4-byte aligned; values are
+ * signed 32-bit words.  atomicAdd32 and atomicCompareExchange32 return the
+ * old value.  Every one of them is a full barrier, as is fence().
+ *
+ * atomicWait32(addr, expected[, ms]) sleeps while the word at addr holds
+ * expected, for at most ms milliseconds, and returns "ok", "not-equal" or
+ * "timed-out"; a wakeup may be spurious, so callers recheck.  atomicNotify
+ * (addr[, count]) wakes up to count waiters, all by default, and returns
+ * how many it woke.  They are Linux futexes, so they also work between
+ * processes sharing a mapping, and a waiting thread is off the engine.
+ *
+ * The operations are x86 instructions in inline asm, which tcc and gcc both
+ * accept; xchg with memory is implicitly locked.
+ */
+static int32
+AtomicExchange(volatile int32 *p, int32 v)
+{
+    __asm__ __volatile__("xchgl %0, %1" : "+r" (v), "+m" (*p) : : "memory");
+    return v;
+}
+
+static int32
+AtomicFetchAdd(volatile int32 *p, int32 v)
+{
+    __asm__ __volatile__("lock; xaddl %0, %1" : "+r" (v), "+m" (*p)
+                         : : "memory");
+    return v;
+}
+
+static int32
+AtomicCompareExchange(volatile int32 *p, int32 expected, int32 v)
+{
+    int32 old;
+
+    __asm__ __volatile__("lock; cmpxchgl %2, %1"
+                         : "=a" (old), "+m" (*p)
+                         : "r" (v), "0" (expected)
+                         : "memory");
+    return old;
+}
+
+static JSBool
+AtomicAddress(JSContext *cx, jsval v, volatile int32 **pp)
+{
+    int a;
+
+    if (!HEAP_ADDR(cx, v, &a))
+        return JS_FALSE;
+    if (a & 3) {
+        JS_ReportError(cx, "atomic access to unaligned address 0x%x", a);
+        return JS_FALSE;
+    }
+    *pp = (volatile int32 *) a;
+    return JS_TRUE;
+}
+
+static JSBool
+atomicLoad32(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+             jsval *rval)
+{
+    volatile int32 *p;
+
+    if (!AtomicAddress(cx, argv[0], &p))
+        return JS_FALSE;
+    return ffi_IntToValue(cx, AtomicFetchAdd(p, 0), rval);
+}
+
+static JSBool
+atomicStore32(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+              jsval *rval)
+{
+    volatile int32 *p;
+    int v;
+
+    if (!AtomicAddress(cx, argv[0], &p) || !HEAP_ADDR(cx, argv[1], &v))
+        return JS_FALSE;
+    AtomicExchange(p, v);
+    return JS_TRUE;
+}
+
+static JSBool
+atomicAdd32(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+            jsval *rval)
+{
+    volatile int32 *p;
+    int v;
+
+    if (!AtomicAddress(cx, argv[0], &p) || !HEAP_ADDR(cx, argv[1], &v))
+        return JS_FALSE;
+    return ffi_IntToValue(cx, AtomicFetchAdd(p, v), rval);
+}
+
+static JSBool
+atomicCompareExchange32(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                        jsval *rval)
+{
+    volatile int32 *p;
+    int expected, v;
+
+    if (!AtomicAddress(cx, argv[0], &p) ||
+        !HEAP_ADDR(cx, argv[1], &expected) || !HEAP_ADDR(cx, argv[2], &v)) {
+        return JS_FALSE;
+    }
+    return ffi_IntToValue(cx, AtomicCompareExchange(p, expected, v), rval);
+}
+
+static JSBool
+atomicFence(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+            jsval *rval)
+{
+    int32 scratch = 0;
+
+    AtomicExchange(&scratch, 0);
+    return JS_TRUE;
+}
+
+#ifdef __linux__
+static JSBool
+atomicWait32(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+             jsval *rval)
+{
+    volatile int32 *p;
+    int expected;
+    jsdouble ms;
+    struct timespec ts, *tsp;
+    const char *result;
+    JSString *str;
+    long rv;
+#ifdef JS_THREADSAFE
+    jsrefcount depth;
+#endif
+
+    if (!AtomicAddress(cx, argv[0], &p) ||
+        !HEAP_ADDR(cx, argv[1], &expected)) {
+        return JS_FALSE;
+    }
+    tsp = NULL;
+    if (argc > 2 && !JSVAL_IS_VOID(argv[2])) {
+        if (!JS_ValueToNumber(cx, argv[2], &ms))
+            return JS_FALSE;
+        if (ms == ms && ms < 1e12) {
+            if (ms < 0)
+                ms = 0;
+            ts.tv_sec = (time_t) (ms / 1000);
+            ts.tv_nsec = (long) ((ms - ts.tv_sec * 1000.0) * 1e6);
+            tsp = &ts;
+        }
+    }
+
+    /* Don't hold up the engine, or under JS_THREADSAFE its GC, meanwhile. */
+#ifdef JS_THREADSAFE
+    depth = JS_SuspendRequest(cx);
+#endif
+    EngineLeave();
+    rv = syscall(SYS_futex, p, FUTEX_WAIT, expected, tsp, NULL, 0);
+    EngineEnter();
+#ifdef JS_THREADSAFE
+    JS_ResumeRequest(cx, depth);
+#endif
+    if (rv == 0 || errno == EINTR)
+        result = "ok";
+    else if (errno == EAGAIN)
+        result = "not-equal";
+    else if (errno == ETIMEDOUT)
+        result = "timed-out";
+    else {
+        JS_ReportError(cx, "atomicWait32: %s", strerror(errno));
+        return JS_FALSE;
+    }
+    str = JS_NewStringCopyZ(cx, result);
+    if (!str)
+        return JS_FALSE;
+    *rval = STRING_TO_JSVAL(str);
+    return JS_TRUE;
+}
+
+static JSBool
+atomicNotify(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+             jsval *rval)
+{
+    volatile int32 *p;
+    int count;
+    long rv;
+
+    if (!AtomicAddress(cx, argv[0], &p))
+        return JS_FALSE;
+    count = INT_MAX;
+    if (argc > 1 && !JSVAL_IS_VOID(argv[1]) && !HEAP_ADDR(cx, argv[1], &count))
+        return JS_FALSE;
+    rv = syscall(SYS_futex, p, FUTEX_WAKE, count, NULL, NULL, 0);
+    if (rv < 0) {
+        JS_ReportError(cx, "atomicNotify: %s", strerror(errno));
+        return JS_FALSE;
+    }
+    return ffi_IntToValue(cx, (int) rv, rval);
+}
+#endif
+
+#define MSG_UNDEFINED   0
+#define MSG_NULL        1
+#define MSG_BOOLEAN     2
+#define MSG_NUMBER      3
+#define MSG_STRING      4
+#define MSG_NUMBERS     5
+#define MSG_BYTES       6
+
+typedef struct WorkerMessage {
+    struct WorkerMessage *next;
+    uintN       type;
+    jsdouble    number;         /* MSG_BOOLEAN, MSG_NUMBER */
+    void        *data;          /* malloc'd jschars, jsdoubles or bytes */
+    size_t      length;         /* of data, in elements */
+} WorkerMessage;
+
+typedef struct WorkerQueue {
+    WorkerMessage *head;
+    WorkerMessage **tail;
+} WorkerQueue;
+
+typedef struct Worker {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;           /* broadcast on any change below */
+    WorkerQueue     toWorker;
+    WorkerQueue     toParent;
+    JSBool          closing;        /* terminate(), close() or parent gone */
+    JSBool          done;           /* the thread has finished */
+    int             refs;           /* held by the parent object, thread */
+    char            *path;
+} Worker;
+
+static void
+WorkerMessageFree(WorkerMessage *msg)
+{
+    free(msg->data);
+    free(msg);
+}
+
+/* Copy v, or with transfer take a ByteBuffer's bytes, into a new message. */
+static WorkerMessage *
+WorkerEncode(JSContext *cx, jsval v, JSBool transfer)
+{
+    WorkerMessage *msg;
+    JSObject *obj;
+    JSString *str;
+    ByteBuffer *bb;
+    jsdouble *nums;
+    jsuint i, n;
+    jsval elem;
+
+    msg = (WorkerMessage *) calloc(1, sizeof *msg);
+    if (!msg) {
+        JS_ReportOutOfMemory(cx);
+        return NULL;
+    }
+    if (JSVAL_IS_VOID(v)) {
+        msg->type = MSG_UNDEFINED;
+    } else if (JSVAL_IS_NULL(v)) {
+        msg->type = MSG_NULL;
+    } else if (JSVAL_IS_BOOLEAN(v)) {
+        msg->type = MSG_BOOLEAN;
+        msg->number = JSVAL_TO_BOOLEAN(v);
+    } else if (JSVAL_IS_NUMBER(v)) {
+        msg->type = MSG_NUMBER;
+        if (!JS_ValueToNumber(cx, v, &msg->number))
+            goto bad;
+    } else if (JSVAL_IS_STRING(v)) {
+        str = JSVAL_TO_STRING(v);
+        msg->type = MSG_STRING;
+        msg->length = JS_GetStringLength(str);
+        msg->data = malloc((msg->length + 1) * sizeof(jschar));
+        if (!msg->data)
+            goto nomem;
+        memcpy(msg->data, JS_GetStringChars(str),
+               msg->length * sizeof(jschar));
+    } else {
+        obj = JSVAL_TO_OBJECT(v);
+        bb = GetByteBuffer(cx, obj, NULL);
+        if (bb) {
+            msg->type = MSG_BYTES;
+            msg->length = ByteBufferLength(bb);
+            if (transfer && (bb->flags & BB_OWNED) && !bb->root && bb->data) {
+                msg->data = bb->data;
+                bb->data = NULL;
+                bb->length = bb->capacity = 0;
+            } else {
+                msg->data = malloc(msg->length ? msg->length : 1);
+                if (!msg->data)
+                    goto nomem;
+                memcpy(msg->data, ByteBufferData(bb), msg->length);
+            }
+        } else if (JS_IsArrayObject(cx, obj)) {
+            if (!JS_GetArrayLength(cx, obj, &n))
+                goto bad;
+            msg->type = MSG_NUMBERS;
+            msg->length = n;
+            nums = (jsdouble *) malloc((n ? n : 1) * sizeof *nums);
+            msg->data = nums;
+            if (!nums)
+                goto nomem;
+            for (i = 0; i < n; i++) {
+                if (!JS_GetElement(cx, obj, (jsint) i, &elem) ||
+                    !JS_ValueToNumber(cx, elem, &nums[i])) {
+                    goto bad;
+                }
+            }
+        } else {
+            JS_ReportError(cx, "a worker message must be a primitive, an "
+                               "array of numbers or a ByteBuffer");
+            goto bad;
+        }
+    }
+    return msg;
+
+  nomem:
+    JS_ReportOutOfMemory(cx);
+  bad:
+    WorkerMessageFree(msg);
+    return NULL;
+}
+
+/* Make msg's value in cx's runtime; *vp must be rooted. */
+static JSBool
+WorkerDecode(JSContext *cx, WorkerMessage *msg, jsval *vp)
+{
+    JSObject *obj;
+    JSString *str;
+    jsdouble *nums;
+    jsval elem;
+    size_t i;
+
+    switch (msg->type) {
+      case MSG_NULL:
+        *vp = JSVAL_NULL;
+        return JS_TRUE;
+      case MSG_BOOLEAN:
+        *vp = BOOLEAN_TO_JSVAL(msg->number != 0);
+        return JS_TRUE;
+      case MSG_NUMBER:
+        return JS_NewNumberValue(cx, msg->number, vp);
+      case MSG_STRING:
+        str = JS_NewUCStringCopyN(cx, (jschar *) msg->data, msg->length);
+        if (!str)
+            return JS_FALSE;
+        *vp = STRING_TO_JSVAL(str);
+        return JS_TRUE;
+      case MSG_NUMBERS:
+        obj = JS_NewArrayObject(cx, 0, NULL);
+        if (!obj)
+            return JS_FALSE;
+        *vp = OBJECT_TO_JSVAL(obj);
+        nums = (jsdouble *) msg->data;
+        for (i = 0; i < msg->length; i++) {
+            if (!JS_NewNumberValue(cx, nums[i], &elem) ||
+                !JS_SetElement(cx, obj, (jsint) i, &elem)) {
+                return JS_FALSE;
+            }
+        }
+        return JS_TRUE;
+      case MSG_BYTES:
+        /* malloc'd bytes are fine for JS_free, so the buffer takes them. */
+        obj = NewByteBuffer(cx, (uint8_t *) msg->data, msg->length, BB_OWNED);
+        if (!obj)
+            return JS_FALSE;
+        msg->data = NULL;
+        *vp = OBJECT_TO_JSVAL(obj);
+        return JS_TRUE;
+    }
+    *vp = JSVAL_VOID;
+    return JS_TRUE;
+}
+
+static void
+WorkerPut(Worker *w, WorkerQueue *q, WorkerMessage *msg)
+{
+    pthread_mutex_lock(&w->lock);
+    *q->tail = msg;
+    q->tail = &msg->next;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/*
+ * Wait, off the engine, for the next message on q; returns NULL once q is
+ * empty and *endp, which w->lock guards, is set.
+ */
+static WorkerMessage *
+WorkerTake(Worker *w, WorkerQueue *q, JSBool *endp)
+{
+    WorkerMessage *msg;
+
+    EngineLeave();
+    pthread_mutex_lock(&w->lock);
+    while (!q->head && !*endp)
+        pthread_cond_wait(&w->cond, &w->lock);
+    msg = q->head;
+    if (msg) {
+        q->head = msg->next;
+        if (!q->head)
+            q->tail = &q->head;
+    }
+    pthread_mutex_unlock(&w->lock);
+    EngineEnter();
+    return msg;
+}
+
+static void
+WorkerClose(Worker *w)
+{
+    pthread_mutex_lock(&w->lock);
+    w->closing = JS_TRUE;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void
+WorkerRelease(Worker *w)
+{
+    WorkerMessage *msg;
+    int refs;
+
+    pthread_mutex_lock(&w->lock);
+    refs = --w->refs;
+    pthread_mutex_unlock(&w->lock);
+    if (refs > 0)
+        return;
+    while ((msg = w->toWorker.head) != NULL) {
+        w->toWorker.head = msg->next;
+        WorkerMessageFree(msg);
+    }
+    while ((msg = w->toParent.head) != NULL) {
+        w->toParent.head = msg->next;
+        WorkerMessageFree(msg);
+    }
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    free(w->path);
+    free(w);
+}
+
+/* Natives in a worker's global; the context's private data is the Worker. */
+
+static JSBool
+worker_postMessage(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                   jsval *rval)
+{
+    Worker *w = (Worker *) JS_GetContextPrivate(cx);
+    WorkerMessage *msg;
+    JSBool transfer;
+
+    transfer = JS_FALSE;
+    if (argc > 1 && !JS_ValueToBoolean(cx, argv[1], &transfer))
+        return JS_FALSE;
+    msg = WorkerEncode(cx, argc > 0 ? argv[0] : JSVAL_VOID, transfer);
+    if (!msg)
+        return JS_FALSE;
+    WorkerPut(w, &w->toParent, msg);
+    return JS_TRUE;
+}
+
+static JSBool
+worker_receive(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+               jsval *rval)
+{
+    Worker *w = (Worker *) JS_GetContextPrivate(cx);
+    WorkerMessage *msg;
+    JSBool ok;
+
+    msg = WorkerTake(w, &w->toWorker, &w->closing);
+    if (!msg)
+        return JS_TRUE;
+    ok = WorkerDecode(cx, msg, rval);
+    WorkerMessageFree(msg);
+    return ok;
+}
+
+static JSBool
+worker_close(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+             jsval *rval)
+{
+    WorkerClose((Worker *) JS_GetContextPrivate(cx));
+    return JS_TRUE;
+}
+
+static JSFunctionSpec worker_global_functions[] = {
+    {"postMessage",     worker_postMessage,     2},
+    {"receive",         worker_receive,         0},
+    {"close",           worker_close,           0},
+    {0}
+};
+
+/* Call obj.onmessage(msg), if it is a function; *rootp is scratch. */
+static JSBool
+WorkerDispatch(JSContext *cx, JSObject *obj, WorkerMessage *msg, jsval *rootp)
+{
+    jsval fval, ignored;
+
+    if (!JS_GetProperty(cx, obj, "onmessage", &fval))
+        return JS_FALSE;
+    if (JS_TypeOfValue(cx, fval) != JSTYPE_FUNCTION)
+        return JS_TRUE;
+    if (!WorkerDecode(cx, msg, rootp))
+        return JS_FALSE;
+    return JS_CallFunctionValue(cx, obj, fval, 1, rootp, &ignored);
+}
+
+static JSBool
+WorkerHasHandler(JSContext *cx, JSObject *obj)
+{
+    jsval fval;
+
+    return JS_GetProperty(cx, obj, "onmessage", &fval) &&
+           JS_TypeOfValue(cx, fval) == JSTYPE_FUNCTION;
+}
+
+static void *
+WorkerMain(void *arg)
+{
+    Worker *w = (Worker *) arg;
+    JSRuntime *rt;
+    JSContext *cx;
+    JSObject *glob;
+    JSScript *script;
+    WorkerMessage *msg;
+    jsval result, root;
+    JSBool ok;
+
+    EngineEnter();
+    rt = JS_NewRuntime(WORKER_RUNTIME_BYTES);
+    cx = rt ? JS_NewContext(rt, gStackChunkSize) : NULL;
+    if (cx) {
+#ifdef JS_THREADSAFE
+        JS_BeginRequest(cx);
+#endif
+        JS_SetContextPrivate(cx, w);
+        JS_SetErrorReporter(cx, my_ErrorReporter);
+#ifndef JS_THREADSAFE
+        JS_SetBranchCallback(cx, WorkerBranchCallback);
+#endif
+        glob = NewShellGlobal(cx);
+        script = NULL;
+        if (glob && JS_DefineFunctions(cx, glob, worker_global_functions))
+            script = CompileFileCached(cx, glob, w->path, NULL);
+        if (script) {
+            ok = JS_ExecuteScript(cx, glob, script, &result);
+            JS_DestroyScript(cx, script);
+
+            /* Serve messages for as long as there's a handler for them. */
+            root = JSVAL_VOID;
+            if (ok && JS_AddNamedRoot(cx, &root, "worker message")) {
+                while (WorkerHasHandler(cx, glob)) {
+                    msg = WorkerTake(w, &w->toWorker, &w->closing);
+                    if (!msg)
+                        break;
+                    if (!WorkerDispatch(cx, glob, msg, &root))
+                        JS_ClearPendingException(cx);
+                    WorkerMessageFree(msg);
+                    root = JSVAL_VOID;
+                    JS_MaybeGC(cx);
+                }
+                JS_RemoveRoot(cx, &root);
+            }
+        }
+#ifdef JS_THREADSAFE
+        JS_EndRequest(cx);
+#endif
+        JS_DestroyContext(cx);
+    } else {
+        fprintf(gErrFile, "can't create a runtime for worker %s\n", w->path);
+    }
+    if (rt)
+        JS_DestroyRuntime(rt);
+    EngineLeave();
+
+    pthread_mutex_lock(&w->lock);
+    w->done = JS_TRUE;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    WorkerRelease(w);
+    return NULL;
+}
+
+/* The parent's side. */
+
+static void
+worker_finalize(JSContext *cx, JSObject *obj)
+{
+    Worker *w;
+
+    w = (Worker *) JS_GetPrivate(cx, obj);
+    if (!w)
+        return;
+    WorkerClose(w);
+    WorkerRelease(w);
+}
+
+static JSClass worker_class = {
+    "Worker", JSCLASS_HAS_PRIVATE,
+    JS_PropertyStub,  JS_PropertyStub,
+    JS_PropertyStub,  JS_PropertyStub,
+    JS_EnumerateStub, JS_ResolveStub,
+    JS_ConvertStub,   worker_finalize
+};
+
+static Worker *
+GetWorker(JSContext *cx, JSObject *obj, jsval *argv)
+{
+    return (Worker *) JS_GetInstancePrivate(cx, obj, &worker_class, argv);
+}
+
+/* new Worker(path): start a thread running the script at path. */
+static JSBool
+Worker_ctor(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+            jsval *rval)
+{
+    JSObject *wobj;
+    Worker *w;
+    char *path;
+    pthread_t tid;
+    int err;
+#ifndef JS_THREADSAFE
+    JSBranchCallback old;
+#endif
+
+    if (!JS_ConvertArguments(cx, argc, argv, "s", &path))
+        return JS_FALSE;
+    w = (Worker *) calloc(1, sizeof *w);
+    if (!w || !(w->path = strdup(path))) {
+        free(w);
+        JS_ReportOutOfMemory(cx);
+        return JS_FALSE;
+    }
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    w->toWorker.tail = &w->toWorker.head;
+    w->toParent.tail = &w->toParent.head;
+    w->refs = 1;
+
+    wobj = JS_NewObject(cx, &worker_class, NULL, NULL);
+    if (!wobj || !JS_SetPrivate(cx, wobj, w)) {
+        WorkerRelease(w);
+        return JS_FALSE;
+    }
+    *rval = OBJECT_TO_JSVAL(wobj);
+
+    w->refs++;
+    err = pthread_create(&tid, NULL, WorkerMain, w);
+    if (err != 0) {
+        w->refs--;
+        w->done = JS_TRUE;
+        JS_ReportError(cx, "can't start worker %s: %s", path, strerror(err));
+        return JS_FALSE;
+    }
+    pthread_detach(tid);
+#ifndef JS_THREADSAFE
+    /* Let the new thread in now and then. */
+    old = JS_SetBranchCallback(cx, WorkerBranchCallback);
+    if (old != WorkerBranchCallback)
+        gWorkerNextBranchCallback = old;
+#endif
+    return JS_TRUE;
+}
+
+static JSBool
+Worker_postMessage(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                   jsval *rval)
+{
+    Worker *w;
+    WorkerMessage *msg;
+    JSBool transfer;
+
+    w = GetWorker(cx, obj, argv);
+    if (!w)
+        return JS_FALSE;
+    transfer = JS_FALSE;
+    if (argc > 1 && !JS_ValueToBoolean(cx, argv[1], &transfer))
+        return JS_FALSE;
+    msg = WorkerEncode(cx, argc > 0 ? argv[0] : JSVAL_VOID, transfer);
+    if (!msg)
+        return JS_FALSE;
+    WorkerPut(w, &w->toWorker, msg);
+    return JS_TRUE;
+}
+
+static JSBool
+Worker_receive(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+               jsval *rval)
+{
+    Worker *w;
+    WorkerMessage *msg;
+    JSBool ok;
+
+    w = GetWorker(cx, obj, argv);
+    if (!w)
+        return JS_FALSE;
+    msg = WorkerTake(w, &w->toParent, &w->done);
+    if (!msg)
+        return JS_TRUE;
+    ok = WorkerDecode(cx, msg, rval);
+    WorkerMessageFree(msg);
+    return ok;
+}
+
+/* join(): wait for the worker to finish, passing messages to onmessage. */
+static JSBool
+Worker_join(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+            jsval *rval)
+{
+    Worker *w;
+    WorkerMessage *msg;
+    JSBool ok;
+
+    w = GetWorker(cx, obj, argv);
+    if (!w)
+        return JS_FALSE;
+    while ((msg = WorkerTake(w, &w->toParent, &w->done)) != NULL) {
+        ok = WorkerDispatch(cx, obj, msg, rval);
+        WorkerMessageFree(msg);
+        if (!ok)
+            return JS_FALSE;
+    }
+    *rval = JSVAL_VOID;
+    return JS_TRUE;
+}
+
+static JSBool
+Worker_terminate(JSContext *cx, JSObject *obj, uintN argc, jsval *argv,
+                 jsval *rval)
+{
+    Worker *w;
+
+    w = GetWorker(cx, obj, argv);
+    if (!w)
+        return JS_FALSE;
+    WorkerClose(w);
+    return JS_TRUE;
+}
+
+static JSFunctionSpec worker_methods[] = {
+    {"postMessage",     Worker_postMessage,     2},
+    {"receive",         Worker_receive,         0},
+    {"join",            Worker_join,            0},
+    {"terminate",       Worker_terminate,       0},
+    {0}
+};
+
+static JSBool
+InitWorkerClass(JSContext *cx, JSObject *obj)
+{
+    return JS_InitClass(cx, obj, NULL, &worker_class, Worker_ctor, 1,
+                        NULL, worker_methods, NULL, NULL) != NULL;
+}
@@ -4,50 +4,25 @@ function to_hex(x) {
 
 dlsym_ptr = get_dlsym();
 
-function dlsym(handle, name) {
-  return ffi_call(dlsym_ptr, handle, name);
-}
-
 print("dlsym_ptr: "+to_hex(dlsym_ptr));
 
-puts = (function() {
-  var puts_ptr = dlsym(0, "puts");
-  return function(str) {
-    return ffi_call(puts_ptr, str);
-  };
-})();
+/* generic 8-argument path */
+puts_ptr = ffi_call(dlsym_ptr, 0, "puts");
+ffi_call(puts_ptr, "Hello world via ffi_call");
+
+/* bound, signature-typed path */
+dlsym = ffi_bind(dlsym_ptr, "p(ps)");
 
-puts("Hello world via ffi");
+puts = ffi_bind(dlsym(0, "puts"), "i(s)");
+
+puts("Hello world via ffi_bind");
 
 libc = {};
 
-libc.calloc = (function() {
-  var calloc_ptr = dlsym(0, "calloc");
-  return function(nmemb, size) {
-    return ffi_call(calloc_ptr, nmemb, size);
-  };
-})();
-
-libc.fopen = (function() {
-  var fopen_ptr = dlsym(0, "fopen");
-  return function(path, mode) {
-    return ffi_call(fopen_ptr, path, mode);
-  };
-})();
-
-libc.fwrite = (function() {
-  var fwrite_ptr = dlsym(0, "fwrite");
-  return function(ptr, size, nmemb, stream) {
-    return ffi_call(fwrite_ptr, ptr, size, nmemb, stream);
-  };
-})();
-
-libc.fclose = (function() {
-  var fclose_ptr = dlsym(0, "fclose");
-  return function(stream) {
-    return ffi_call(fclose_ptr, stream);
-  };
-})();
+libc.calloc = ffi_bind(dlsym(0, "calloc"), "p(ii)");
+libc.fopen = ffi_bind(dlsym(0, "fopen"), "p(ss)");
+libc.fwrite = ffi_bind(dlsym(0, "fwrite"), "i(piip)");
+libc.fclose = ffi_bind(dlsym(0, "fclose"), "i(p)");
 
 m = libc.calloc(1024, 1);
 
@@ -61,12 +36,11 @@ function write_file(oname, data) {
   if(oname === undefined) {
     throw "oname is undefined";
   }
-  for(var i = 0; i <data.length; i++) {
-    poke8(t+i, data[i]);
-  }
-  var f = libc.fopen(oname, "wb");
-  libc.fwrite(t, 1, data.length, f);
-  libc.fclose(f);
+  copyArrayToHeap(t, data);
+  /* fopen, fwrite and fclose in a single native call */
+  ffi_batch([libc.fopen, 2, oname, "wb",
+             libc.fwrite, 4, t, 1, data.length, [0],
+             libc.fclose, 1, [0]]);
 }
 
 d = [65, 66, 67];
@@ -74,3 +48,9 @@ d = [65, 66, 67];
 gc();
 
 write_file(arguments[1], d);
+
+b = new ByteBuffer("Hi from a ByteBuffer");
+b.push(0);
+puts(b);
+print("length: " + b.length + ", b[0]: " + b[0] + ", tail: " +
+      copyHeapToString(b.subarray(-8).pointer()));